@@ -0,0 +1,119 @@
+#ifndef FIPA_SERVICES_TYPES_HPP
+#define FIPA_SERVICES_TYPES_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <base/Time.hpp>
+#include <fipa_services/transports/Configuration.hpp>
+
+namespace fipa_services {
+
+    /**
+     * Status of the store-and-forward spool of a single destination, i.e.
+     * a receiver that has been unreachable when a letter had to be routed
+     */
+    struct SpoolStatus
+    {
+        /// Name of the receiver the letters are spooled for
+        std::string destination;
+        /// Number of letters currently in the journal
+        uint32_t letters;
+        /// Number of bytes currently occupied by letters in the journal
+        uint32_t bytes;
+        /// Number of letters dropped due to the size or age limit
+        uint32_t dropped;
+        /// Number of letters replayed so far
+        uint32_t replayed;
+        /// Replay rate in letters per second over the last reporting period
+        double replay_rate;
+        /// Time of the oldest letter in the journal (null if empty)
+        base::Time oldest;
+
+        SpoolStatus()
+            : letters(0)
+            , bytes(0)
+            , dropped(0)
+            , replayed(0)
+            , replay_rate(0.0)
+        {}
+    };
+
+    /**
+     * Configuration for the coalescing of small letters into frames per
+     * remote message transport and transport type
+     *
+     * Letters are only coalesced for receivers whose message transport
+     * announces the support for frames in the service directory, i.e. never
+     * for older message transports or gateways, and not at all for transports
+     * without a configuration.
+     */
+    struct FrameConfiguration
+    {
+        /// Transport this configuration applies to
+        fipa::services::transports::Type transport_type;
+        /// Letters with a serialized size up to this size (in bytes) are coalesced
+        uint32_t max_letter_size;
+        /// A frame is sent when it reaches this size (in bytes)
+        uint32_t max_frame_size;
+        /// A frame is sent at the latest after this delay (in seconds)
+        double max_delay;
+
+        FrameConfiguration()
+            : transport_type(fipa::services::transports::UDT)
+            , max_letter_size(512)
+            , max_frame_size(8192)
+            , max_delay(0.01)
+        {}
+    };
+
+    /**
+     * Configuration of the multicast fan-out of letters addressed to
+     * receivers on multiple remote message transports
+     *
+     * Letters whose receivers are attached to at least min_peers remote message
+     * transports in the multicast group are sent once to the group instead of
+     * once per message transport. Message transports in the group announce their
+     * local receivers periodically; letters to all other receivers are sent via
+     * unicast.
+     *
+     * Multicast datagrams are neither acknowledged nor retransmitted, i.e.
+     * letters sent via multicast have no delivery guarantee. Hence, only
+     * letters of protocols which tolerate loss are sent via multicast.
+     */
+    struct MulticastConfiguration
+    {
+        /// Multicast group address, e.g. 239.255.41.1; multicast is disabled if empty
+        std::string group;
+        /// Port of the multicast group
+        uint16_t port;
+        /// Address of the local interface to use, the default interface if empty
+        std::string interface_address;
+        /// Time-to-live of multicast datagrams
+        uint32_t ttl;
+        /// Minimum number of remote message transports for a letter to be sent via multicast
+        uint32_t min_peers;
+        /// Maximum size of a multicast datagram (in bytes) -- larger letters are sent via unicast;
+        /// keep it below the path MTU (1472 bytes of UDP payload on Ethernet) to avoid IP fragmentation
+        uint32_t max_payload;
+        /// ACL protocols of letters which tolerate loss and may be sent via multicast;
+        /// letters of all other protocols are sent via unicast
+        std::vector<std::string> protocols;
+        /// Interval (in seconds) for announcing the local receivers to the group
+        double beacon_interval;
+        /// Time (in seconds) after which a receiver is no longer considered as reachable via multicast if it has not been announced
+        double peer_timeout;
+
+        MulticastConfiguration()
+            : port(41414)
+            , ttl(1)
+            , min_peers(2)
+            , max_payload(1400)
+            , beacon_interval(1.0)
+            , peer_timeout(5.0)
+        {}
+    };
+
+} // namespace fipa_services
+
+#endif // FIPA_SERVICES_TYPES_HPP
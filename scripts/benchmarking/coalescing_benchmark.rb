@@ -0,0 +1,148 @@
+#! /usr/bin/env ruby
+#
+# Benchmark of the letter throughput between two MTS with and without
+# coalescing of small letters into frames (property: frame_configurations)
+#
+# [ MTS: sender-mts   ]-sender_client
+# [ MTS: receiver-mts ]-receiver_client
+#
+# The sender_client sends a burst of letters to the receiver_client for each
+# content size -- the number of letters per second received by the
+# receiver_client is reported per content size along with the number of
+# sent and received letters. Letters which did not arrive within the idle
+# timeout are considered as lost.
+#
+require 'orocos'
+require_relative 'fipa_benchmark'
+require 'optparse'
+
+include Orocos
+
+allowed_transports = [ "UDT", "TCP"]
+o_transport = "UDT"
+o_letters = 2000
+o_content_sizes = [16, 32, 64, 128, 256]
+o_max_frame_size = 8192
+o_max_delay = 0.01
+o_idle_timeout_in_s = 5
+
+options = OptionParser.new do |opts|
+    opts.banner = "usage: #{$0}"
+    opts.on("-t","--transport TYPE", "Select transport type: either TCP or UDT") do |transport|
+        if allowed_transports.include?(transport)
+            o_transport = transport
+        else
+            puts "Transport '#{transport}' is unknown -- select one of #{allowed_transports.join(',')}"
+            exit 1
+        end
+    end
+    opts.on("-n","--letters NUMBER", Integer, "Number of letters per content size, default: #{o_letters}") do |letters|
+        o_letters = letters
+    end
+    opts.on("-f","--max-frame-size BYTES", Integer, "Maximum size of a frame, default: #{o_max_frame_size}") do |size|
+        o_max_frame_size = size
+    end
+    opts.on("-d","--max-delay SECONDS", Float, "Maximum delay of a letter in a frame, default: #{o_max_delay}") do |delay|
+        o_max_delay = delay
+    end
+    opts.on("-i","--idle-timeout SECONDS", Float, "Time to wait for further letters before the remaining ones are considered as lost, default: #{o_idle_timeout_in_s}") do |timeout|
+        o_idle_timeout_in_s = timeout
+    end
+    opts.on("-h","--help") do
+        puts opts
+        exit 0
+    end
+end
+
+unhandled_arguments = options.parse(ARGV)
+
+def setup(mts, transport, client, frame_configurations)
+    if mts.running?
+        mts.stop
+    end
+    if mts.state == :STOPPED
+        mts.cleanup
+    end
+    mts.transports = [ transport ]
+    mts.frame_configurations = frame_configurations
+    mts.configure
+    mts.start
+    mts.addReceiver(client, true)
+end
+
+def measure(benchmark, writer, receiver_reader, content_size, letters, idle_timeout_in_s)
+    # Flush previously received letters
+    while receiver_reader.read_new
+    end
+
+    # Create the letters upfront, so that only their transport is measured
+    burst = (1..letters).map { benchmark.create_sender_letter(benchmark.from, benchmark.to, content_size) }
+
+    start = Time.now
+    received = 0
+    last_received = nil
+    burst.each do |letter|
+        writer.write(letter)
+        while receiver_reader.read_new
+            received += 1
+            last_received = Time.now
+        end
+    end
+
+    idle_start = Time.now
+    while received < letters && Time.now - [idle_start, last_received || idle_start].max < idle_timeout_in_s
+        while receiver_reader.read_new
+            received += 1
+            last_received = Time.now
+        end
+        sleep 0.001
+    end
+
+    rate = last_received ? received / (last_received - start) : 0.0
+    { :sent => letters, :received => received, :rate => rate }
+end
+
+Orocos.initialize
+Orocos.run "fipa_services::MessageTransportTask" => ["sender-mts", "receiver-mts"] do
+    sender = TaskContext.get "sender-mts"
+    receiver = TaskContext.get "receiver-mts"
+
+    frame_configuration = {
+        :transport_type => o_transport.to_sym,
+        :max_letter_size => 512,
+        :max_frame_size => o_max_frame_size,
+        :max_delay => o_max_delay
+    }
+
+    results = Hash.new
+    [ [], [ frame_configuration ] ].each do |frame_configurations|
+        mode = frame_configurations.empty? ? :unicast : :coalesced
+        puts "Benchmarking mode: #{mode}"
+
+        setup(sender, o_transport, "sender_client", frame_configurations)
+        setup(receiver, o_transport, "receiver_client", frame_configurations)
+        # Wait for the service directories to be updated
+        sleep 5
+
+        benchmark = FIPA::Benchmark.new(sender, "sender_client", "receiver_client")
+        # The buffers hold a complete burst, so that no letter is dropped
+        # before it reaches the MTS
+        writer = sender.letters.writer :type => :buffer, :size => o_letters
+        receiver_reader = receiver.port("receiver_client").reader :type => :buffer, :size => o_letters
+
+        o_content_sizes.each do |content_size|
+            results[content_size] ||= Hash.new
+            result = measure(benchmark, writer, receiver_reader, content_size, o_letters, o_idle_timeout_in_s)
+            results[content_size][mode] = result
+            puts "    content size #{content_size}: #{result[:rate]} letters/s, received #{result[:received]} of #{result[:sent]} letters"
+        end
+    end
+
+    puts "# content-size unicast[letters/s] unicast[received/sent] coalesced[letters/s] coalesced[received/sent] gain"
+    results.each do |content_size, result|
+        unicast = result[:unicast]
+        coalesced = result[:coalesced]
+        gain = unicast[:rate] > 0 ? coalesced[:rate] / unicast[:rate] : 0.0
+        puts "#{content_size} #{unicast[:rate]} #{unicast[:received]}/#{unicast[:sent]} #{coalesced[:rate]} #{coalesced[:received]}/#{coalesced[:sent]} #{gain}"
+    end
+end
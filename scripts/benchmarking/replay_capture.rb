@@ -0,0 +1,183 @@
+#! /usr/bin/env ruby
+#
+# Replay a letter capture into the 'letters' port of a running MessageTransportTask
+#
+# A capture is written by the MessageTransportTask when its property
+# 'capture_file' is set -- refer to tasks/LetterCapture.hpp for the format.
+# Letters are replayed either with the recorded timing, with a scaled timing
+# or as fast as possible.
+# The number of letters handled by the MessageTransportTask is measured via its
+# 'letters_debug' port -- letters that have been replayed, but never showed up
+# there have been dropped, e.g. due to a full buffer of the letters port.
+#
+# Example:
+#    ruby replay_capture.rb --mts mts --capture-file traffic.cap --speed 4
+#
+require 'orocos'
+require 'optparse'
+include Orocos
+
+o_mts = "mts"
+o_capture_file = ""
+o_speed = 1.0
+o_max_speed = false
+o_loops = 1
+o_buffer_size = 1000
+o_drain_timeout = 2.0
+
+options = OptionParser.new do |opts|
+    opts.banner = "usage: #{$0}"
+    opts.on("-m","--mts NAME", "Name of the MessageTransportTask to replay into, default: #{o_mts}") do |name|
+        o_mts = name
+    end
+    opts.on("-c","--capture-file PATH", "Path to the capture file") do |path|
+        o_capture_file = path
+    end
+    opts.on("-s","--speed FACTOR", Float, "Scale the recorded timing, e.g. 2 replays twice as fast, default: #{o_speed}") do |speed|
+        o_speed = speed
+    end
+    opts.on("-x","--max-speed", "Replay as fast as possible, ignoring the recorded timing") do
+        o_max_speed = true
+    end
+    opts.on("-l","--loops NUMBER", Integer, "Number of times the capture is replayed, default: #{o_loops}") do |loops|
+        o_loops = loops
+    end
+    opts.on("-b","--buffer-size NUMBER", Integer, "Size of the buffers of the connections to the letters and letters_debug ports, default: #{o_buffer_size}") do |size|
+        o_buffer_size = size
+    end
+    opts.on("-d","--drain-timeout SECONDS", Float, "Time to wait for further handled letters after the replay, default: #{o_drain_timeout}") do |timeout|
+        o_drain_timeout = timeout
+    end
+    opts.on("-h","--help") do
+        puts opts
+        exit  0
+    end
+end
+
+unhandled_arguments = options.parse(ARGV)
+
+if o_capture_file.empty? || o_speed <= 0
+    puts options
+    exit 0
+end
+
+module FIPA
+    # Reader for letter captures written by the MessageTransportTask
+    class Capture
+        MAGIC = "FIPACAPT"
+        VERSION = 1
+
+        Record = Struct.new(:timestamp, :representation, :source, :data)
+
+        attr_reader :records
+
+        def initialize(filename)
+            @records = Array.new
+            File.open(filename, "rb") do |file|
+                magic, version, _ = file.read(16).unpack("a8L<L<")
+                if magic != MAGIC || version != VERSION
+                    raise ArgumentError, "#{filename} is not a letter capture of version #{VERSION}"
+                end
+
+                while header = file.read(20)
+                    timestamp, representation, source_size, data_size = header.unpack("q<L<L<L<")
+                    source = file.read(source_size)
+                    data = file.read(data_size)
+                    if data.nil? || data.size != data_size
+                        STDERR.puts "#{filename} -- truncated record after #{@records.size} letters"
+                        break
+                    end
+                    @records << Record.new(timestamp, representation, source, data)
+                end
+            end
+        end
+    end
+end
+
+capture = FIPA::Capture.new(o_capture_file)
+puts "#{o_capture_file} -- #{capture.records.size} letters"
+if capture.records.empty?
+    exit 0
+end
+
+Orocos.initialize
+
+mts = TaskContext.get o_mts
+writer = mts.letters.writer :type => :buffer, :size => o_buffer_size
+debug_reader = mts.letters_debug.reader :type => :buffer, :size => o_buffer_size
+
+# Map the captured representation to the name used by typelib
+representation_type = writer.new_sample.class[:representation]
+representations = Hash.new
+representation_type.keys.each do |name, value|
+    representations[value] = name
+end
+
+# Count the letters handled by the MTS
+handled_letters = 0
+handled_bytes = 0
+last_handled = nil
+read_handled = lambda do
+    while letter = debug_reader.read_new
+        handled_letters += 1
+        handled_bytes += letter.data.size
+        last_handled = Time.now
+    end
+end
+
+first_timestamp = capture.records.first.timestamp
+total_letters = 0
+total_bytes = 0
+max_lag = 0.0
+start = Time.now
+
+(1..o_loops).each do |iteration|
+    loop_start = Time.now
+    capture.records.each do |record|
+        if !o_max_speed
+            due = loop_start + (record.timestamp - first_timestamp) / 1.0e6 / o_speed
+            read_handled.call
+            delay = due - Time.now
+            if delay > 0
+                sleep delay
+            else
+                max_lag = [max_lag, -delay].max
+            end
+        end
+
+        letter = writer.new_sample
+        letter.data = record.data.unpack("C*")
+        letter.representation = representations[record.representation]
+        letter.timestamp = Time.now
+        writer.write(letter)
+
+        total_letters += 1
+        total_bytes += record.data.size
+        read_handled.call
+    end
+    puts "Replayed loop #{iteration} of #{o_loops}"
+end
+replay_elapsed = Time.now - start
+
+# Wait for the remaining letters to be handled
+drain_start = Time.now
+while handled_letters < total_letters && Time.now - [drain_start, last_handled || drain_start].max < o_drain_timeout
+    read_handled.call
+    sleep 0.01
+end
+
+puts "Replayed #{total_letters} letters (#{total_bytes} bytes) in #{replay_elapsed} seconds"
+if !o_max_speed
+    puts "    maximum lag behind recorded timing: #{max_lag} seconds"
+end
+
+if handled_letters == 0
+    puts "No letters have been handled by the MTS"
+    exit 1
+end
+
+elapsed = last_handled - start
+dropped = total_letters - handled_letters
+puts "MTS handled #{handled_letters} letters (#{handled_bytes} bytes) in #{elapsed} seconds"
+puts "    #{handled_letters / elapsed} letters/s, #{handled_bytes / elapsed / 1024.0} kB/s"
+puts "    dropped letters: #{dropped} (#{100.0 * dropped / total_letters}%)"
@@ -0,0 +1,81 @@
+require 'orocos'
+require 'readline'
+require 'fipa-message'
+include Orocos
+Orocos.initialize
+
+# This test the bulk registration of receivers
+#
+# [ MTS: blue ]-agent_0 ... agent_299
+#
+# 1. add 300 receivers in a single batch
+# 2. send message from agent_0 to agent_299 --> should succeed, while the
+#    receivers are still being announced to the service directory
+# 3. remove all receivers in a single batch
+# 4. add and remove the same receivers one by one for comparison
+Orocos.run "fipa_services::MessageTransportTask" => "blue-mts", :valgrind => false do
+
+    blue = TaskContext.get 'blue-mts'
+    blue.configure
+    blue.start
+
+    agents = (0..299).map { |i| "agent_#{i}" }
+
+    start = Time.now
+    if !blue.addReceivers(agents, true)
+        raise RuntimeError, "Adding receivers failed"
+    end
+    bulk_add = Time.now - start
+    puts "Added #{agents.size} receivers in #{bulk_add} seconds"
+    puts "Registered receivers: #{blue.getReceivers.size}"
+
+    msg = FIPA::ACLMessage.new
+    msg.setContent("test-content")
+    msg.setSender(FIPA::AgentId.new(agents.first))
+    msg.addReceiver(FIPA::AgentId.new(agents.last))
+
+    env = FIPA::ACLEnvelope.new
+    env.insert(msg, FIPARepresentation::BITEFFICIENT)
+
+    receiver_reader = blue.port(agents.last).reader
+    postman = blue.letters.writer
+    postman.write(env)
+
+    sleep 1
+    if envelope = receiver_reader.read_new
+        puts "#{agents.last} received data"
+        puts "Content: #{envelope.getACLMessage.getContent}"
+    else
+        puts "#{agents.last} did not receive data"
+    end
+
+    start = Time.now
+    if !blue.removeReceivers(agents)
+        raise RuntimeError, "Removing receivers failed"
+    end
+    bulk_remove = Time.now - start
+    puts "Removed #{agents.size} receivers in #{bulk_remove} seconds"
+    puts "Registered receivers: #{blue.getReceivers.size}"
+
+    # Per receiver operations for comparison
+    start = Time.now
+    agents.each do |agent|
+        if !blue.addReceiver(agent, true)
+            raise RuntimeError, "Adding receiver '#{agent}' failed"
+        end
+    end
+    single_add = Time.now - start
+
+    start = Time.now
+    agents.each do |agent|
+        if !blue.removeReceiver(agent)
+            raise RuntimeError, "Removing receiver '#{agent}' failed"
+        end
+    end
+    single_remove = Time.now - start
+
+    puts "Added #{agents.size} receivers one by one in #{single_add} seconds (bulk: #{bulk_add} seconds)"
+    puts "Removed #{agents.size} receivers one by one in #{single_remove} seconds (bulk: #{bulk_remove} seconds)"
+
+    Readline::readline("Press ENTER to proceed")
+end
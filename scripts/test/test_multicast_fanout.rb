@@ -0,0 +1,72 @@
+require 'orocos'
+require 'readline'
+require 'fipa-message'
+include Orocos
+Orocos.initialize
+
+# This test the multicast fan-out of letters on loopback
+#
+# [ MTS: blue   ]-blue_client     (multicast)
+# [ MTS: red    ]-red_client      (multicast)
+# [ MTS: yellow ]-yellow_client   (multicast)
+# [ MTS: green  ]-green_client    (unicast only)
+#
+# 1. send message from blue_client to all clients via broadcast --> should succeed,
+#    red and yellow are served via a single multicast datagram, green via unicast
+#
+# Multicast on loopback might require a corresponding route:
+#    sudo ip route add 239.0.0.0/8 dev lo
+Orocos.run "fipa_services::MessageTransportTask" => ["blue-mts", "red-mts","yellow-mts","green-mts"] , :valgrind => false do
+
+    clients = Hash.new
+    ["blue", "red", "yellow", "green"].each do |name|
+        mts = TaskContext.get "#{name}-mts"
+        if name != "green"
+            multicast_configuration = mts.multicast_configuration
+            multicast_configuration.group = "239.255.41.1"
+            multicast_configuration.interface_address = "127.0.0.1"
+            # Only letters of these protocols are sent via multicast
+            multicast_configuration.protocols = ["fanout-test"]
+            mts.multicast_configuration = multicast_configuration
+        end
+        mts.configure
+        mts.start
+        mts.addReceiver("#{name}_client", true)
+        clients[name] = mts.port("#{name}_client").reader
+        if name == "blue"
+            clients[:postman] = mts.letters.writer
+        end
+    end
+
+    # Wait for the service directory and the multicast beacons
+    sleep 5
+
+    msg = FIPA::ACLMessage.new
+    msg.setContent("test-content")
+    msg.setProtocol("fanout-test")
+    msg.setSender(FIPA::AgentId.new("blue_client"))
+    msg.addReceiver(FIPA::AgentId.new(".*_client"))
+
+    env = FIPA::ACLEnvelope.new
+    env.insert(msg, FIPARepresentation::BITEFFICIENT)
+
+    postman = clients.delete(:postman)
+    postman.write(env)
+
+    while true
+        clients.each do |name, reader|
+            if envelope = reader.read_new
+                puts "#{name.capitalize} client received data"
+                puts "DeliveryPath:"
+                envelope.getDeliveryPath.each do |agent_id|
+                    puts "#{agent_id.getName}"
+                end
+                puts "Content: #{envelope.getACLMessage.getContent}"
+            end
+        end
+
+        puts "Waiting"
+        sleep 1
+        Readline::readline("Press ENTER to proceed")
+    end
+end
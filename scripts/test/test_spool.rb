@@ -0,0 +1,137 @@
+require 'orocos'
+require 'readline'
+require 'fileutils'
+require 'fipa-message'
+include Orocos
+Orocos.initialize
+
+# This test the store-and-forward spool
+#
+# [ MTS: blue ]-blue_client (spool)
+# [ MTS: red  ]-red_client
+#
+# 1. stop red and send messages from blue_client to red_client --> messages are spooled by blue
+# 2. restart blue --> spooled messages are restored from the journal
+# 3. restart red and send further messages during the replay --> all messages
+#    are received in order, the backlog is drained at the replay rate
+# 4. stop red again with a short maximum age --> spooled messages expire and
+#    the journal is removed
+spool_directory = "/tmp/fipa_services_test_spool"
+spooled_messages = 50
+live_messages = 10
+replay_rate = 10.0
+
+FileUtils.rm_rf(spool_directory)
+
+def create_envelope(index)
+    msg = FIPA::ACLMessage.new
+    msg.setContent("spool-test-#{index}")
+    msg.setSender(FIPA::AgentId.new("blue_client"))
+    msg.addReceiver(FIPA::AgentId.new("red_client"))
+
+    env = FIPA::ACLEnvelope.new
+    env.insert(msg, FIPARepresentation::BITEFFICIENT)
+    env
+end
+
+def start_mts(mts, client)
+    mts.configure
+    mts.start
+    mts.addReceiver(client, true)
+end
+
+def stop_mts(mts)
+    mts.stop
+    mts.cleanup
+end
+
+def spooled_letters(status_reader)
+    # The spool status is written once per second
+    sleep 1.5
+    if status = status_reader.read
+        status.inject(0) { |sum, journal| sum + journal.letters }
+    else
+        0
+    end
+end
+
+Orocos.run "fipa_services::MessageTransportTask" => ["blue-mts", "red-mts"] , :valgrind => false do
+
+    blue = TaskContext.get 'blue-mts'
+    blue.spool_directory = spool_directory
+    blue.spool_replay_rate = replay_rate
+    start_mts(blue, "blue_client")
+
+    red = TaskContext.get 'red-mts'
+    start_mts(red, "red_client")
+
+    postman = blue.letters.writer :type => :buffer, :size => spooled_messages + live_messages
+    status_reader = blue.spool_status.reader
+
+    # 1. Spool while red is unreachable
+    stop_mts(red)
+    # Wait for the service directory
+    sleep 5
+
+    spooled_messages.times do |i|
+        postman.write(create_envelope(i))
+    end
+    puts "Spooled letters: #{spooled_letters(status_reader)} (expected: #{spooled_messages})"
+
+    # 2. Restore after a restart
+    stop_mts(blue)
+    start_mts(blue, "blue_client")
+    postman = blue.letters.writer :type => :buffer, :size => spooled_messages + live_messages
+    status_reader = blue.spool_status.reader
+    puts "Restored letters: #{spooled_letters(status_reader)} (expected: #{spooled_messages})"
+
+    # 3. Replay once red is back
+    start_mts(red, "red_client")
+    red_client_reader = red.port("red_client").reader :type => :buffer, :size => spooled_messages + live_messages
+
+    received = Array.new
+    start = nil
+    live_index = spooled_messages
+    timeout = Time.now + spooled_messages / replay_rate + 20
+    while received.size < spooled_messages + live_messages && Time.now < timeout
+        while envelope = red_client_reader.read_new
+            start ||= Time.now
+            received << envelope.getACLMessage.getContent.sub("spool-test-", "").to_i
+        end
+
+        # Messages sent during the replay must not overtake the backlog
+        if start && live_index < spooled_messages + live_messages
+            postman.write(create_envelope(live_index))
+            live_index += 1
+        end
+        sleep 0.1
+    end
+
+    duration = start ? Time.now - start : 0
+    puts "Received #{received.size} of #{spooled_messages + live_messages} messages in #{"%.1f" % duration} seconds (expected: about #{"%.1f" % (spooled_messages / replay_rate)} seconds at the replay rate)"
+    if received == (0...spooled_messages + live_messages).to_a
+        puts "Messages received in order"
+    else
+        puts "Messages received out of order or incomplete: #{received.inspect}"
+    end
+    puts "Journals after replay: #{Dir.glob(File.join(spool_directory, "*.journal")).size} (expected: 0)"
+
+    # 4. Expiry
+    stop_mts(blue)
+    blue.spool_max_age = 2.0
+    start_mts(blue, "blue_client")
+    postman = blue.letters.writer :type => :buffer, :size => spooled_messages + live_messages
+    status_reader = blue.spool_status.reader
+
+    stop_mts(red)
+    sleep 5
+
+    live_messages.times do |i|
+        postman.write(create_envelope(i))
+    end
+    sleep 3
+    puts "Spooled letters after expiry: #{spooled_letters(status_reader)} (expected: 0)"
+    puts "Journals after expiry: #{Dir.glob(File.join(spool_directory, "*.journal")).size} (expected: 0)"
+
+    Readline::readline("Press ENTER to proceed")
+end
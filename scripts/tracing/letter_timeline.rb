@@ -0,0 +1,226 @@
+#! /usr/bin/env ruby
+
+# Reconstruct per letter timelines and a breakdown of the processing stages from
+# a trace of the MessageTransportTask tracepoints, as recorded by trace_letters.bt
+#
+# Stages of a letter written by a local client:
+#   read         end of the previous step in updateHook until _letters.read returned
+#   deserialize  letter read until letter deserialized
+#   handle       routing of the letter, i.e. MessageTransport::handle incl. local deliveries
+#   delivery     write to the port of a local receiver (per receiver)
+#
+# Letters received from remote message transports are delivered in
+# MessageTransport::trigger and only show up with their delivery stage.
+
+require 'optparse'
+
+o_trace_file = ""
+o_summary_only = false
+o_conversation_id = nil
+
+options = OptionParser.new do |opts|
+    opts.banner = "usage: #{$0} --trace-file PATH"
+    opts.on("-t","--trace-file PATH", "Trace as recorded by trace_letters.bt") do |path|
+        o_trace_file = path
+    end
+    opts.on("-s","--summary-only", "Print the stage breakdown only") do
+        o_summary_only = true
+    end
+    opts.on("-c","--conversation-id ID", "Print the timelines of letters with the given conversation id only") do |id|
+        o_conversation_id = id
+    end
+    opts.on("-h","--help") do
+        puts opts
+        exit  0
+    end
+end
+
+unhandled_arguments = options.parse(ARGV)
+
+if o_trace_file.empty?
+    puts options
+    exit 0
+end
+
+Event = Struct.new(:timestamp, :tid, :name, :conversation_id, :size, :receiver)
+
+# Timeline of a single letter, timestamps in ns
+class LetterTimeline
+    attr_accessor :conversation_id, :size, :origin, :start
+    attr_reader :stages, :deliveries
+
+    def initialize(origin, start)
+        @origin = origin
+        @start = start
+        @stages = Hash.new
+        @deliveries = Array.new
+    end
+
+    def add_stage(name, from, to)
+        @stages[name] = [from, to]
+    end
+
+    def add_delivery(receiver, from, to)
+        @deliveries << [receiver, from, to]
+    end
+
+    def stop
+        ([@start] + @stages.values.map { |from, to| to } + @deliveries.map { |receiver, from, to| to }).max
+    end
+
+    def duration
+        stop - @start
+    end
+end
+
+# Processing state of a single thread
+class ThreadState
+    attr_accessor :last_timestamp, :letter, :handling, :trigger_begin, :deliveries
+
+    def initialize
+        @deliveries = Hash.new
+    end
+end
+
+def parse_trace(filename)
+    events = Array.new
+    File.open(filename).each_line do |line|
+        next if line.start_with?("#") || line.strip.empty?
+        fields = line.chomp.split("\t", -1)
+        if fields.size < 6 || fields[0] !~ /^\d+$/
+            next
+        end
+        events << Event.new(fields[0].to_i, fields[1].to_i, fields[2], fields[3], fields[4].empty? ? nil : fields[4].to_i, fields[5])
+    end
+    events.sort_by { |e| e.timestamp }
+end
+
+def reconstruct(events)
+    letters = Array.new
+    triggers = Array.new
+    threads = Hash.new { |h,k| h[k] = ThreadState.new }
+
+    events.each do |event|
+        state = threads[event.tid]
+        case event.name
+        when "update_begin"
+            state.letter = nil
+            state.handling = false
+        when "letter_read"
+            state.letter = LetterTimeline.new(:local, state.last_timestamp || event.timestamp)
+            state.letter.size = event.size
+            state.letter.add_stage(:read, state.letter.start, event.timestamp)
+            letters << state.letter
+        when "letter_deserialized"
+            if letter = state.letter
+                letter.conversation_id = event.conversation_id
+                letter.add_stage(:deserialize, letter.stages[:read][1], event.timestamp)
+            end
+        when "letter_handle_begin"
+            # Letters unpacked from a frame are handled without being read from the port
+            if !state.letter || state.letter.stages.has_key?(:handle)
+                state.letter = LetterTimeline.new(:frame, event.timestamp)
+                state.letter.size = event.size
+                letters << state.letter
+            end
+            state.letter.conversation_id ||= event.conversation_id
+            state.letter.add_stage(:handle, event.timestamp, nil)
+            state.handling = true
+        when "letter_handle_end"
+            if state.letter && state.letter.stages.has_key?(:handle)
+                state.letter.stages[:handle][1] = event.timestamp
+            end
+            state.handling = false
+        when "trigger_begin"
+            state.trigger_begin = event.timestamp
+        when "trigger_end"
+            if state.trigger_begin
+                triggers << event.timestamp - state.trigger_begin
+            end
+            state.trigger_begin = nil
+        when "local_delivery_begin"
+            state.deliveries[[event.conversation_id, event.receiver]] = event.timestamp
+        when "local_delivery_end"
+            from = state.deliveries.delete([event.conversation_id, event.receiver]) || event.timestamp
+            if state.handling && state.letter && state.letter.conversation_id == event.conversation_id
+                state.letter.add_delivery(event.receiver, from, event.timestamp)
+            else
+                # Letter from a remote message transport
+                letter = LetterTimeline.new(:remote, from)
+                letter.conversation_id = event.conversation_id
+                letter.size = event.size
+                letter.add_delivery(event.receiver, from, event.timestamp)
+                letters << letter
+            end
+        end
+        state.last_timestamp = event.timestamp
+    end
+
+    letters.each do |letter|
+        letter.stages.delete_if { |name, (from, to)| to.nil? }
+    end
+    [letters, triggers]
+end
+
+def us(ns)
+    ns / 1000.0
+end
+
+def statistics(values)
+    return nil if values.empty?
+    sorted = values.sort
+    percentile = lambda { |p| sorted[[(p * sorted.size).ceil - 1, 0].max] }
+    { :count => sorted.size,
+      :mean => sorted.inject(0.0) { |sum,v| sum + v } / sorted.size,
+      :p50 => percentile.call(0.5),
+      :p99 => percentile.call(0.99),
+      :max => sorted.last }
+end
+
+events = parse_trace(o_trace_file)
+if events.empty?
+    puts "No events found in trace '#{o_trace_file}'"
+    exit 0
+end
+
+letters, triggers = reconstruct(events)
+if o_conversation_id
+    letters = letters.select { |letter| letter.conversation_id == o_conversation_id }
+end
+trace_start = events.first.timestamp
+
+if !o_summary_only
+    puts "Letter timelines [us] (start relative to the beginning of the trace)"
+    letters.each do |letter|
+        stages = [:read, :deserialize, :handle].map do |name|
+            if stage = letter.stages[name]
+                "#{name}=#{"%.1f" % us(stage[1] - stage[0])}"
+            end
+        end.compact
+        letter.deliveries.each do |receiver, from, to|
+            stages << "delivery(#{receiver})=#{"%.1f" % us(to - from)}"
+        end
+        puts "#{"%12.1f" % us(letter.start - trace_start)}  #{letter.origin.to_s.ljust(6)} conversation: '#{letter.conversation_id}' size: #{letter.size} total=#{"%.1f" % us(letter.duration)} #{stages.join(" ")}"
+    end
+    puts
+end
+
+stage_durations = Hash.new { |h,k| h[k] = Array.new }
+letters.each do |letter|
+    letter.stages.each do |name, (from, to)|
+        stage_durations[name] << to - from
+    end
+    letter.deliveries.each do |receiver, from, to|
+        stage_durations[:delivery] << to - from
+    end
+    stage_durations["total (#{letter.origin})"] << letter.duration
+end
+stage_durations[:trigger] = triggers
+
+puts "Stage breakdown [us]"
+puts "#{"stage".ljust(20)} #{"count".rjust(8)} #{"mean".rjust(10)} #{"p50".rjust(10)} #{"p99".rjust(10)} #{"max".rjust(10)}"
+[:read, :deserialize, :handle, :delivery, :trigger].concat(stage_durations.keys.select { |k| k.is_a?(String) }.sort).each do |name|
+    if stats = statistics(stage_durations[name])
+        puts "#{name.to_s.ljust(20)} #{stats[:count].to_s.rjust(8)} #{("%.1f" % us(stats[:mean])).rjust(10)} #{("%.1f" % us(stats[:p50])).rjust(10)} #{("%.1f" % us(stats[:p99])).rjust(10)} #{("%.1f" % us(stats[:max])).rjust(10)}"
+    end
+end
@@ -0,0 +1,158 @@
+#include "FrameCoalescer.hpp"
+#include <algorithm>
+
+namespace fipa_services
+{
+
+const std::string FrameCoalescer::PROTOCOL = "fipa-services-frame";
+
+// Size of representation and length preceding each letter in a frame
+static const size_t FRAME_RECORD_HEADER_SIZE = 5;
+// Tag announcing the support for frames in a service description
+static const std::string FRAME_SUPPORT_TAG = " [" + FrameCoalescer::PROTOCOL + "]";
+
+FrameCoalescer::FrameCoalescer(const std::vector<FrameConfiguration>& configurations)
+    : mConfigurations(configurations)
+    , mFrameCount(0)
+    , mLetterCount(0)
+{}
+
+const FrameConfiguration* FrameCoalescer::getConfiguration(fipa::services::transports::Type transportType) const
+{
+    std::vector<FrameConfiguration>::const_iterator it = mConfigurations.begin();
+    for(; it != mConfigurations.end(); ++it)
+    {
+        if(it->transport_type == transportType)
+        {
+            return &(*it);
+        }
+    }
+    return NULL;
+}
+
+void FrameCoalescer::add(const std::string& peer, const std::string& receiver, const FrameConfiguration& configuration,
+        const fipa::SerializedLetter& letter, const base::Time& now, std::vector<Frame>& frames)
+{
+    const std::vector<uint8_t>& data = letter.getVector();
+
+    Frames::iterator it = mFrames.find(peer);
+    if(it != mFrames.end() && it->second.data.size() + FRAME_RECORD_HEADER_SIZE + data.size() > configuration.max_frame_size)
+    {
+        flush(it, frames);
+        it = mFrames.end();
+    }
+
+    if(it == mFrames.end())
+    {
+        it = mFrames.insert(std::make_pair(peer, Frame())).first;
+        it->second.peer = peer;
+        it->second.first = letter;
+        it->second.deadline = now + base::Time::fromSeconds(configuration.max_delay);
+    }
+
+    Frame& frame = it->second;
+    if(std::find(frame.receivers.begin(), frame.receivers.end(), receiver) == frame.receivers.end())
+    {
+        frame.receivers.push_back(receiver);
+    }
+    frame.data.reserve(configuration.max_frame_size);
+    frame.data.push_back(static_cast<uint8_t>(letter.representation));
+    uint32_t length = data.size();
+    for(size_t i = 0; i < 4; ++i)
+    {
+        frame.data.push_back(static_cast<uint8_t>(length >> (8*i)));
+    }
+    frame.data.insert(frame.data.end(), data.begin(), data.end());
+    ++frame.letters;
+
+    if(frame.data.size() >= configuration.max_frame_size)
+    {
+        flush(it, frames);
+    }
+}
+
+void FrameCoalescer::flush(Frames::iterator it, std::vector<Frame>& frames)
+{
+    ++mFrameCount;
+    mLetterCount += it->second.letters;
+    frames.push_back(it->second);
+    mFrames.erase(it);
+}
+
+void FrameCoalescer::flushPeer(const std::string& peer, std::vector<Frame>& frames)
+{
+    Frames::iterator it = mFrames.find(peer);
+    if(it != mFrames.end())
+    {
+        flush(it, frames);
+    }
+}
+
+void FrameCoalescer::flushExpired(const base::Time& now, std::vector<Frame>& frames)
+{
+    Frames::iterator it = mFrames.begin();
+    while(it != mFrames.end())
+    {
+        if(it->second.deadline <= now)
+        {
+            flush(it++, frames);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FrameCoalescer::flushAll(std::vector<Frame>& frames)
+{
+    while(!mFrames.empty())
+    {
+        flush(mFrames.begin(), frames);
+    }
+}
+
+bool FrameCoalescer::unpack(const std::string& data, std::vector<fipa::SerializedLetter>& letters)
+{
+    // Letters are only appended if the whole frame is valid
+    std::vector<fipa::SerializedLetter> unpackedLetters;
+    size_t offset = 0;
+    while(offset < data.size())
+    {
+        if(offset + FRAME_RECORD_HEADER_SIZE > data.size())
+        {
+            return false;
+        }
+
+        fipa::SerializedLetter letter;
+        letter.representation = static_cast<fipa::acl::representation::Type>(static_cast<uint8_t>(data[offset]));
+        uint32_t length = 0;
+        for(size_t i = 0; i < 4; ++i)
+        {
+            length |= static_cast<uint32_t>(static_cast<uint8_t>(data[offset + 1 + i])) << (8*i);
+        }
+        offset += FRAME_RECORD_HEADER_SIZE;
+
+        if(length > data.size() - offset)
+        {
+            return false;
+        }
+        letter.data.assign(data.begin() + offset, data.begin() + offset + length);
+        offset += length;
+
+        unpackedLetters.push_back(letter);
+    }
+    letters.insert(letters.end(), unpackedLetters.begin(), unpackedLetters.end());
+    return true;
+}
+
+std::string FrameCoalescer::announceSupport(const std::string& description)
+{
+    return description + FRAME_SUPPORT_TAG;
+}
+
+bool FrameCoalescer::isSupported(const std::string& description)
+{
+    return description.size() >= FRAME_SUPPORT_TAG.size()
+        && description.compare(description.size() - FRAME_SUPPORT_TAG.size(), FRAME_SUPPORT_TAG.size(), FRAME_SUPPORT_TAG) == 0;
+}
+
+} // namespace fipa_services
@@ -0,0 +1,146 @@
+#ifndef FIPA_SERVICES_FRAME_COALESCER_HPP
+#define FIPA_SERVICES_FRAME_COALESCER_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <base/Time.hpp>
+#include <fipa_acl/message_generator/serialized_letter.h>
+#include "fipa_servicesTypes.hpp"
+
+namespace fipa_services {
+
+    /**
+     * A set of serialized letters that is sent as a single letter to a
+     * remote message transport
+     */
+    struct Frame
+    {
+        /// Transport address of the remote message transport
+        std::string peer;
+        /// Receivers of the packed letters -- the frame is addressed to one of them
+        std::vector<std::string> receivers;
+        /// Packed letters
+        std::vector<uint8_t> data;
+        /// Number of packed letters
+        uint32_t letters;
+        /// The first letter -- a frame with a single letter is sent as this letter
+        fipa::SerializedLetter first;
+        /// Latest time the frame will be sent
+        base::Time deadline;
+
+        Frame()
+            : letters(0)
+        {}
+    };
+
+    /**
+     * \class FrameCoalescer
+     * \brief Coalesces small letters bound for the same remote message transport into frames
+     * \details Small letters, which are addressed to a single receiver, are
+     * packed per remote message transport. A frame is flushed once it exceeds the
+     * configured frame size or its deadline has been reached. The frame is sent as the
+     * content of a letter with the protocol FrameCoalescer::PROTOCOL to one of the
+     * receivers of its letters, which all live on the same remote message transport.
+     * The receiving message transport unpacks each letter and delivers it separately.
+     *
+     * Message transports announce their support for frames in the description of
+     * the directory entries of their receivers (see announceSupport). Letters are
+     * only coalesced for receivers whose entry announces support, so that frames are
+     * never sent to a message transport or gateway which does not support them.
+     *
+     * Frames use the encoding (representation: uint8 | length: uint32 little endian | serialized letter)*
+     */
+    class FrameCoalescer
+    {
+    public:
+        /// Protocol of letters carrying a frame
+        static const std::string PROTOCOL;
+
+        FrameCoalescer(const std::vector<FrameConfiguration>& configurations);
+
+        /**
+         * Get the configuration for a transport
+         * \return configuration or NULL if letters for this transport shall not be coalesced
+         */
+        const FrameConfiguration* getConfiguration(fipa::services::transports::Type transportType) const;
+
+        /**
+         * Add a letter to the frame of a remote message transport
+         * \param peer Transport address of the remote message transport
+         * \param receiver Receiver of the letter
+         * \param configuration Frame configuration for the transport to the remote message transport
+         * \param letter The serialized letter
+         * \param now Current time
+         * \param frames Frames that are ready to be sent will be appended
+         */
+        void add(const std::string& peer, const std::string& receiver, const FrameConfiguration& configuration,
+                const fipa::SerializedLetter& letter, const base::Time& now, std::vector<Frame>& frames);
+
+        /**
+         * Retrieve the pending frame of a remote message transport, e.g. to
+         * preserve the order of letters when a letter is sent without
+         * coalescing
+         */
+        void flushPeer(const std::string& peer, std::vector<Frame>& frames);
+
+        /**
+         * Retrieve all frames which reached their deadline
+         */
+        void flushExpired(const base::Time& now, std::vector<Frame>& frames);
+
+        /**
+         * Retrieve all pending frames
+         */
+        void flushAll(std::vector<Frame>& frames);
+
+        /**
+         * Check whether no frame is pending
+         */
+        bool empty() const { return mFrames.empty(); }
+
+        /**
+         * Unpack the letters of a frame; nothing is appended to letters if the
+         * frame is malformed
+         * \return false if the frame is malformed, true otherwise
+         */
+        static bool unpack(const std::string& data, std::vector<fipa::SerializedLetter>& letters);
+
+        /**
+         * Announce the support for frames in the description of a service
+         * directory entry
+         * \return the extended description
+         */
+        static std::string announceSupport(const std::string& description);
+
+        /**
+         * Check whether the description of a service directory entry
+         * announces the support for frames
+         */
+        static bool isSupported(const std::string& description);
+
+        /**
+         * Get the number of frames that have been flushed so far
+         */
+        uint64_t getFrameCount() const { return mFrameCount; }
+
+        /**
+         * Get the number of letters that have been packed so far
+         */
+        uint64_t getLetterCount() const { return mLetterCount; }
+
+    private:
+        typedef std::map<std::string, Frame> Frames;
+
+        void flush(Frames::iterator it, std::vector<Frame>& frames);
+
+        std::vector<FrameConfiguration> mConfigurations;
+        Frames mFrames;
+        uint64_t mFrameCount;
+        uint64_t mLetterCount;
+    };
+
+} // namespace fipa_services
+
+#endif // FIPA_SERVICES_FRAME_COALESCER_HPP
@@ -0,0 +1,88 @@
+#include "LetterCapture.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <stdexcept>
+
+namespace fipa_services
+{
+
+const char LetterCapture::MAGIC[8] = { 'F', 'I', 'P', 'A', 'C', 'A', 'P', 'T' };
+
+// Size of the stream buffer -- keeps the number of write calls low
+static const size_t CAPTURE_BUFFER_SIZE = 1024*1024;
+
+LetterCapture::LetterCapture(const std::string& filename)
+    : mFilename(filename)
+    , mFile(NULL)
+    , mLetterCount(0)
+{
+    mFile = fopen(filename.c_str(), "wb");
+    if(!mFile)
+    {
+        throw std::runtime_error("LetterCapture: could not create capture file '" + filename + "': " + strerror(errno));
+    }
+    setvbuf(mFile, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    if(fwrite(MAGIC, sizeof(MAGIC), 1, mFile) != 1 || !writeUInt32(VERSION) || !writeUInt32(0))
+    {
+        fclose(mFile);
+        throw std::runtime_error("LetterCapture: could not write header of capture file '" + filename + "'");
+    }
+}
+
+LetterCapture::~LetterCapture()
+{
+    if(mFile)
+    {
+        fclose(mFile);
+    }
+}
+
+bool LetterCapture::writeUInt32(uint32_t value)
+{
+    uint8_t buffer[4];
+    for(size_t i = 0; i < sizeof(buffer); ++i)
+    {
+        buffer[i] = static_cast<uint8_t>(value >> (8*i));
+    }
+    return fwrite(buffer, sizeof(buffer), 1, mFile) == 1;
+}
+
+bool LetterCapture::writeInt64(int64_t value)
+{
+    uint64_t unsignedValue = static_cast<uint64_t>(value);
+    uint8_t buffer[8];
+    for(size_t i = 0; i < sizeof(buffer); ++i)
+    {
+        buffer[i] = static_cast<uint8_t>(unsignedValue >> (8*i));
+    }
+    return fwrite(buffer, sizeof(buffer), 1, mFile) == 1;
+}
+
+bool LetterCapture::write(const base::Time& timestamp, const std::string& source, const fipa::SerializedLetter& letter)
+{
+    bool success = writeInt64(timestamp.toMicroseconds())
+        && writeUInt32(static_cast<uint32_t>(letter.representation))
+        && writeUInt32(source.size())
+        && writeUInt32(letter.data.size())
+        && fwrite(source.data(), 1, source.size(), mFile) == source.size();
+
+    if(success && !letter.data.empty())
+    {
+        success = fwrite(&letter.data[0], 1, letter.data.size(), mFile) == letter.data.size();
+    }
+
+    if(success)
+    {
+        ++mLetterCount;
+    }
+    return success;
+}
+
+void LetterCapture::flush()
+{
+    fflush(mFile);
+}
+
+} // namespace fipa_services
@@ -0,0 +1,69 @@
+#ifndef FIPA_SERVICES_LETTER_CAPTURE_HPP
+#define FIPA_SERVICES_LETTER_CAPTURE_HPP
+
+#include <stdio.h>
+#include <string>
+#include <stdint.h>
+#include <base/Time.hpp>
+#include <fipa_acl/message_generator/serialized_letter.h>
+
+namespace fipa_services {
+
+    /**
+     * \class LetterCapture
+     * \brief Compact binary capture of ingress letters of a message transport
+     * \details A capture file starts with a file header, followed by one record
+     * per letter. All integers are stored in little endian byte order.
+     \verbatim
+     file header:   char[8] magic "FIPACAPT" | uint32 version | uint32 reserved
+     record:        int64 timestamp (microseconds) | uint32 representation |
+                    uint32 source length | uint32 data length |
+                    char[] source | uint8[] serialized letter
+     \endverbatim
+     * The timestamp is the time the letter has been read by the message transport,
+     * the source is the name of the sending agent.
+     *
+     * A capture can be replayed with scripts/benchmarking/replay_capture.rb
+     */
+    class LetterCapture
+    {
+    public:
+        static const char MAGIC[8];
+        static const uint32_t VERSION = 1;
+
+        /**
+         * Create a capture file, an existing file will be overwritten
+         * \throws std::runtime_error if the file cannot be created
+         */
+        LetterCapture(const std::string& filename);
+
+        ~LetterCapture();
+
+        /**
+         * Append a letter to the capture
+         * \return false if writing failed, true otherwise
+         */
+        bool write(const base::Time& timestamp, const std::string& source, const fipa::SerializedLetter& letter);
+
+        /**
+         * Flush buffered records to disk
+         */
+        void flush();
+
+        /**
+         * Get the number of letters captured so far
+         */
+        uint64_t getLetterCount() const { return mLetterCount; }
+
+    private:
+        bool writeUInt32(uint32_t value);
+        bool writeInt64(int64_t value);
+
+        std::string mFilename;
+        FILE* mFile;
+        uint64_t mLetterCount;
+    };
+
+} // namespace fipa_services
+
+#endif // FIPA_SERVICES_LETTER_CAPTURE_HPP
@@ -0,0 +1,678 @@
+#include "LetterSpool.hpp"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <rtt/Logger.hpp>
+
+namespace fipa_services
+{
+
+static const char JOURNAL_MAGIC[8] = { 'F', 'I', 'P', 'A', 'J', 'R', 'N', 'L' };
+static const uint32_t JOURNAL_VERSION = 1;
+static const uint32_t JOURNAL_MAX_DESTINATION_LENGTH = 255;
+static const std::string JOURNAL_SUFFIX = ".journal";
+
+struct LetterJournal::Header
+{
+    char magic[8];
+    uint32_t version;
+    /// Size of the journal file
+    uint32_t size;
+    /// Offset of the oldest record
+    uint32_t head;
+    /// Offset past the newest record
+    uint32_t tail;
+    /// Number of records between head and tail
+    uint32_t letters;
+    uint32_t destinationLength;
+    char destination[JOURNAL_MAX_DESTINATION_LENGTH + 1];
+};
+
+struct LetterJournal::RecordHeader
+{
+    /// Time the letter has been spooled in microseconds
+    int64_t spooled;
+    /// Timestamp of the serialized letter in microseconds
+    int64_t timestamp;
+    uint32_t representation;
+    uint32_t length;
+};
+
+////////////////////////////////////////////////////////////////////
+//                         LetterJournal                          //
+////////////////////////////////////////////////////////////////////
+LetterJournal::LetterJournal(const std::string& filename, const std::string& destination, uint32_t maxSize)
+    : mFilename(filename)
+    , mDestination(destination)
+    , mFileDescriptor(-1)
+    , mData(NULL)
+    , mSize(maxSize)
+    , mDropped(0)
+{
+    if(destination.size() > JOURNAL_MAX_DESTINATION_LENGTH)
+    {
+        throw std::runtime_error("LetterJournal: destination name '" + destination + "' exceeds maximum length");
+    }
+
+    if(maxSize < sizeof(Header) + sizeof(RecordHeader))
+    {
+        throw std::runtime_error("LetterJournal: size of journal '" + filename + "' is too small");
+    }
+
+    // Carry over the letters of an existing journal of a different size,
+    // i.e. after the maximum journal size has been changed
+    SpooledLetters carriedOver;
+    struct stat fileStat;
+    if(stat(filename.c_str(), &fileStat) == 0 && fileStat.st_size != 0 && fileStat.st_size != static_cast<off_t>(maxSize))
+    {
+        carriedOver = readLetters(filename, destination, fileStat.st_size);
+    }
+
+    mFileDescriptor = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if(mFileDescriptor < 0)
+    {
+        throw std::runtime_error("LetterJournal: could not open journal '" + filename + "': " + strerror(errno));
+    }
+
+    if(fstat(mFileDescriptor, &fileStat) != 0)
+    {
+        close(mFileDescriptor);
+        throw std::runtime_error("LetterJournal: could not stat journal '" + filename + "': " + strerror(errno));
+    }
+
+    bool resized = static_cast<uint32_t>(fileStat.st_size) != maxSize;
+    if(resized && ftruncate(mFileDescriptor, maxSize) != 0)
+    {
+        close(mFileDescriptor);
+        throw std::runtime_error("LetterJournal: could not resize journal '" + filename + "': " + strerror(errno));
+    }
+
+    void* data = mmap(NULL, maxSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFileDescriptor, 0);
+    if(data == MAP_FAILED)
+    {
+        close(mFileDescriptor);
+        throw std::runtime_error("LetterJournal: could not map journal '" + filename + "': " + strerror(errno));
+    }
+    mData = static_cast<uint8_t*>(data);
+
+    Header* h = header();
+    if(resized
+            || memcmp(h->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0
+            || h->version != JOURNAL_VERSION
+            || h->size != maxSize
+            || std::string(h->destination, std::min(h->destinationLength, JOURNAL_MAX_DESTINATION_LENGTH)) != destination
+            || h->head < sizeof(Header) || h->head > h->tail || h->tail > maxSize)
+    {
+        if(!resized && fileStat.st_size != 0)
+        {
+            RTT::log(RTT::Warning) << "LetterJournal: journal '" << filename << "' is invalid -- resetting" << RTT::endlog();
+        }
+        reset();
+    } else if(!validate()) {
+        RTT::log(RTT::Warning) << "LetterJournal: journal '" << filename << "' contains inconsistent records -- dropping " << h->letters << " letters" << RTT::endlog();
+        reset();
+    } else if(h->letters != 0) {
+        RTT::log(RTT::Info) << "LetterJournal: restored " << h->letters << " letters for '" << destination << "' from '" << filename << "'" << RTT::endlog();
+    }
+
+    if(!carriedOver.empty())
+    {
+        for(SpooledLetters::const_iterator it = carriedOver.begin(); it != carriedOver.end(); ++it)
+        {
+            append(it->first, it->second);
+        }
+        RTT::log(RTT::Info) << "LetterJournal: journal '" << filename << "' has been resized -- carried over " << carriedOver.size() - mDropped << " letters for '" << destination << "'" << RTT::endlog();
+        if(mDropped != 0)
+        {
+            RTT::log(RTT::Warning) << "LetterJournal: dropped " << mDropped << " letters for '" << destination << "' which exceed the new journal size" << RTT::endlog();
+        }
+    }
+}
+
+LetterJournal::SpooledLetters LetterJournal::readLetters(const std::string& filename, const std::string& destination, off_t size)
+{
+    SpooledLetters letters;
+    if(size > static_cast<off_t>(std::numeric_limits<uint32_t>::max()))
+    {
+        RTT::log(RTT::Warning) << "LetterJournal: journal '" << filename << "' exceeds the maximum journal size -- resetting" << RTT::endlog();
+        return letters;
+    }
+
+    try {
+        LetterJournal previous(filename, destination, size);
+        fipa::SerializedLetter letter;
+        base::Time spooled;
+        while(previous.front(letter, spooled))
+        {
+            letters.push_back(std::make_pair(letter, spooled));
+            previous.pop();
+        }
+    } catch(const std::runtime_error& e)
+    {
+        RTT::log(RTT::Warning) << "LetterJournal: could not read letters from resized journal '" << filename << "': " << e.what() << RTT::endlog();
+    }
+    return letters;
+}
+
+LetterJournal::~LetterJournal()
+{
+    if(mData)
+    {
+        msync(mData, mSize, MS_SYNC);
+        munmap(mData, mSize);
+    }
+    if(mFileDescriptor >= 0)
+    {
+        close(mFileDescriptor);
+    }
+}
+
+LetterJournal::Header* LetterJournal::header() const
+{
+    return reinterpret_cast<Header*>(mData);
+}
+
+void LetterJournal::reset()
+{
+    Header* h = header();
+    memset(h, 0, sizeof(Header));
+    memcpy(h->magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    h->version = JOURNAL_VERSION;
+    h->size = mSize;
+    h->head = sizeof(Header);
+    h->tail = sizeof(Header);
+    h->letters = 0;
+    h->destinationLength = mDestination.size();
+    memcpy(h->destination, mDestination.c_str(), mDestination.size());
+}
+
+void LetterJournal::compact()
+{
+    Header* h = header();
+    if(h->head == sizeof(Header))
+    {
+        return;
+    }
+
+    uint32_t used = h->tail - h->head;
+    memmove(mData + sizeof(Header), mData + h->head, used);
+    h->head = sizeof(Header);
+    h->tail = sizeof(Header) + used;
+}
+
+bool LetterJournal::append(const fipa::SerializedLetter& letter, const base::Time& timestamp)
+{
+    uint32_t recordSize = sizeof(RecordHeader) + letter.data.size();
+    if(recordSize > mSize - sizeof(Header))
+    {
+        return false;
+    }
+
+    Header* h = header();
+    // Drop the oldest letters until there is sufficient space
+    while(mSize - sizeof(Header) - (h->tail - h->head) < recordSize)
+    {
+        pop();
+        ++mDropped;
+    }
+
+    if(h->tail + recordSize > mSize)
+    {
+        compact();
+    }
+
+    RecordHeader record;
+    record.spooled = timestamp.toMicroseconds();
+    record.timestamp = letter.timestamp.toMicroseconds();
+    record.representation = static_cast<uint32_t>(letter.representation);
+    record.length = letter.data.size();
+
+    memcpy(mData + h->tail, &record, sizeof(RecordHeader));
+    if(!letter.data.empty())
+    {
+        memcpy(mData + h->tail + sizeof(RecordHeader), &letter.data[0], letter.data.size());
+    }
+    h->tail += recordSize;
+    ++h->letters;
+
+    return true;
+}
+
+bool LetterJournal::readRecord(uint32_t offset, RecordHeader& record) const
+{
+    Header* h = header();
+    if(offset < sizeof(Header) || offset > h->tail || h->tail - offset < sizeof(RecordHeader))
+    {
+        return false;
+    }
+
+    memcpy(&record, mData + offset, sizeof(RecordHeader));
+    return record.length <= h->tail - offset - sizeof(RecordHeader);
+}
+
+bool LetterJournal::readHead(RecordHeader& record)
+{
+    Header* h = header();
+    if(!readRecord(h->head, record))
+    {
+        RTT::log(RTT::Error) << "LetterJournal: journal '" << mFilename << "' is corrupted -- dropping " << h->letters << " letters" << RTT::endlog();
+        mDropped += h->letters;
+        reset();
+        return false;
+    }
+    return true;
+}
+
+bool LetterJournal::validate() const
+{
+    Header* h = header();
+    uint32_t offset = h->head;
+    uint32_t letters = 0;
+    RecordHeader record;
+    while(offset < h->tail)
+    {
+        if(!readRecord(offset, record))
+        {
+            return false;
+        }
+        offset += sizeof(RecordHeader) + record.length;
+        ++letters;
+    }
+    return letters == h->letters;
+}
+
+bool LetterJournal::front(fipa::SerializedLetter& letter, base::Time& timestamp)
+{
+    Header* h = header();
+    RecordHeader record;
+    if(h->letters == 0 || !readHead(record))
+    {
+        return false;
+    }
+
+    const uint8_t* data = mData + h->head + sizeof(RecordHeader);
+    letter.data.assign(data, data + record.length);
+    letter.representation = static_cast<fipa::acl::representation::Type>(record.representation);
+    letter.timestamp = base::Time::fromMicroseconds(record.timestamp);
+    timestamp = base::Time::fromMicroseconds(record.spooled);
+
+    return true;
+}
+
+void LetterJournal::pop()
+{
+    Header* h = header();
+    RecordHeader record;
+    if(h->letters == 0 || !readHead(record))
+    {
+        return;
+    }
+
+    h->head += sizeof(RecordHeader) + record.length;
+    --h->letters;
+
+    if(h->letters == 0)
+    {
+        h->head = sizeof(Header);
+        h->tail = sizeof(Header);
+    }
+}
+
+uint32_t LetterJournal::expire(const base::Time& now, const base::Time& maxAge)
+{
+    uint32_t expired = 0;
+    Header* h = header();
+    RecordHeader record;
+    while(h->letters != 0 && readHead(record))
+    {
+        if(now - base::Time::fromMicroseconds(record.spooled) <= maxAge)
+        {
+            break;
+        }
+        pop();
+        ++expired;
+    }
+    return expired;
+}
+
+uint32_t LetterJournal::getLetterCount() const
+{
+    return header()->letters;
+}
+
+uint32_t LetterJournal::getByteCount() const
+{
+    return header()->tail - header()->head;
+}
+
+bool LetterJournal::readDestination(const std::string& filename, std::string& destination)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if(!file)
+    {
+        return false;
+    }
+
+    Header h;
+    bool valid = fread(&h, sizeof(Header), 1, file) == 1
+        && memcmp(h.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0
+        && h.version == JOURNAL_VERSION
+        && h.destinationLength <= JOURNAL_MAX_DESTINATION_LENGTH;
+    fclose(file);
+
+    if(valid)
+    {
+        destination = std::string(h.destination, h.destinationLength);
+    }
+    return valid;
+}
+
+////////////////////////////////////////////////////////////////////
+//                          LetterSpool                           //
+////////////////////////////////////////////////////////////////////
+LetterSpool::LetterSpool(const std::string& directory, uint32_t maxJournalSize, const base::Time& maxAge, double replayRate)
+    : mDirectory(directory)
+    , mMaxJournalSize(maxJournalSize)
+    , mMaxAge(maxAge)
+    , mReplayRate(replayRate)
+{
+    // Create the directory including its parents
+    for(size_t pos = mDirectory.find('/', 1); ; pos = mDirectory.find('/', pos + 1))
+    {
+        std::string path = mDirectory.substr(0, pos);
+        if(mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            throw std::runtime_error("LetterSpool: could not create directory '" + path + "': " + strerror(errno));
+        }
+        if(pos == std::string::npos)
+        {
+            break;
+        }
+    }
+
+    restore();
+}
+
+LetterSpool::~LetterSpool()
+{
+    for(Journals::iterator it = mJournals.begin(); it != mJournals.end(); ++it)
+    {
+        delete it->second;
+    }
+}
+
+void LetterSpool::restore()
+{
+    DIR* dir = opendir(mDirectory.c_str());
+    if(!dir)
+    {
+        throw std::runtime_error("LetterSpool: could not open directory '" + mDirectory + "': " + strerror(errno));
+    }
+
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL)
+    {
+        std::string name(entry->d_name);
+        if(name.size() <= JOURNAL_SUFFIX.size() || name.compare(name.size() - JOURNAL_SUFFIX.size(), JOURNAL_SUFFIX.size(), JOURNAL_SUFFIX) != 0)
+        {
+            continue;
+        }
+
+        std::string destination;
+        std::string filename = mDirectory + "/" + name;
+        if(!LetterJournal::readDestination(filename, destination) || filename != getJournalFilename(destination))
+        {
+            RTT::log(RTT::Warning) << "LetterSpool: ignoring invalid journal '" << filename << "'" << RTT::endlog();
+            continue;
+        }
+
+        LetterJournal* journal = NULL;
+        try {
+            journal = new LetterJournal(filename, destination, mMaxJournalSize);
+        } catch(const std::runtime_error& e)
+        {
+            RTT::log(RTT::Warning) << "LetterSpool: could not restore journal '" << filename << "': " << e.what() << RTT::endlog();
+            continue;
+        }
+
+        if(journal->empty())
+        {
+            delete journal;
+            unlink(filename.c_str());
+            continue;
+        }
+        mJournals[destination] = journal;
+    }
+    closedir(dir);
+}
+
+std::string LetterSpool::getJournalFilename(const std::string& destination) const
+{
+    // Encode all characters that are not safe for a filename, so that the
+    // mapping from destination to filename remains unique
+    std::string filename;
+    for(std::string::const_iterator it = destination.begin(); it != destination.end(); ++it)
+    {
+        unsigned char c = *it;
+        if(isalnum(c) || c == '-')
+        {
+            filename += c;
+        } else {
+            char encoded[4];
+            snprintf(encoded, sizeof(encoded), "_%02x", c);
+            filename += encoded;
+        }
+    }
+    return mDirectory + "/" + filename + JOURNAL_SUFFIX;
+}
+
+void LetterSpool::removeJournal(Journals::iterator it)
+{
+    std::string destination = it->first;
+    delete it->second;
+    mJournals.erase(it);
+
+    std::string filename = getJournalFilename(destination);
+    if(unlink(filename.c_str()) != 0)
+    {
+        RTT::log(RTT::Warning) << "LetterSpool: could not remove journal '" << filename << "': " << strerror(errno) << RTT::endlog();
+    }
+
+    mReplayBudgets.erase(destination);
+    mExpired.erase(destination);
+    mReplayed.erase(destination);
+    mReplayedSinceStatus.erase(destination);
+}
+
+LetterJournal* LetterSpool::getJournal(const std::string& destination)
+{
+    Journals::iterator it = mJournals.find(destination);
+    if(it != mJournals.end())
+    {
+        return it->second;
+    }
+
+    LetterJournal* journal = new LetterJournal(getJournalFilename(destination), destination, mMaxJournalSize);
+    mJournals[destination] = journal;
+    return journal;
+}
+
+bool LetterSpool::store(const std::string& destination, const fipa::SerializedLetter& letter, const base::Time& now)
+{
+    LetterJournal* journal = NULL;
+    try {
+        journal = getJournal(destination);
+    } catch(const std::runtime_error& e)
+    {
+        RTT::log(RTT::Error) << "LetterSpool: " << e.what() << RTT::endlog();
+        return false;
+    }
+
+    if(!journal->append(letter, now))
+    {
+        RTT::log(RTT::Warning) << "LetterSpool: letter of size '" << letter.data.size() << "' for '" << destination << "' exceeds the journal size" << RTT::endlog();
+        if(journal->empty())
+        {
+            removeJournal(mJournals.find(destination));
+        }
+        return false;
+    }
+    return true;
+}
+
+bool LetterSpool::queue(const std::string& destination, const fipa::SerializedLetter& letter, const base::Time& now)
+{
+    if(!store(destination, letter, now))
+    {
+        return false;
+    }
+    mReplayBudgets[destination] += 1.0;
+    return true;
+}
+
+bool LetterSpool::hasPending(const std::string& destination) const
+{
+    Journals::const_iterator it = mJournals.find(destination);
+    return it != mJournals.end() && !it->second->empty();
+}
+
+std::vector<std::string> LetterSpool::getPendingDestinations() const
+{
+    std::vector<std::string> destinations;
+    for(Journals::const_iterator it = mJournals.begin(); it != mJournals.end(); ++it)
+    {
+        if(!it->second->empty())
+        {
+            destinations.push_back(it->first);
+        }
+    }
+    return destinations;
+}
+
+void LetterSpool::update(const base::Time& now)
+{
+    if(mReplayRate > 0 && !mLastUpdate.isNull())
+    {
+        double refill = mReplayRate * (now - mLastUpdate).toSeconds();
+        for(Journals::const_iterator it = mJournals.begin(); it != mJournals.end(); ++it)
+        {
+            if(it->second->empty())
+            {
+                mReplayBudgets.erase(it->first);
+                continue;
+            }
+
+            // Refill a burst of at most one second worth of letters -- the
+            // budget of queued letters is kept in full
+            double& budget = mReplayBudgets[it->first];
+            double maxBudget = std::max(mReplayRate, 1.0);
+            if(budget < maxBudget)
+            {
+                budget = std::min(budget + refill, maxBudget);
+            }
+        }
+    }
+    mLastUpdate = now;
+
+    if(mMaxAge.isNull())
+    {
+        return;
+    }
+
+    Journals::iterator it = mJournals.begin();
+    while(it != mJournals.end())
+    {
+        uint32_t expired = it->second->expire(now, mMaxAge);
+        if(expired)
+        {
+            RTT::log(RTT::Warning) << "LetterSpool: dropped " << expired << " expired letters for '" << it->first << "'" << RTT::endlog();
+            mExpired[it->first] += expired;
+        }
+
+        if(it->second->empty())
+        {
+            removeJournal(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+uint32_t LetterSpool::replay(const std::string& destination, ReplayHandler handler)
+{
+    Journals::iterator it = mJournals.find(destination);
+    if(it == mJournals.end())
+    {
+        return 0;
+    }
+
+    LetterJournal* journal = it->second;
+    double& budget = mReplayBudgets[destination];
+    uint32_t replayed = 0;
+    fipa::SerializedLetter letter;
+    base::Time spooled;
+    while((mReplayRate <= 0 || budget >= 1.0) && journal->front(letter, spooled))
+    {
+        if(!handler(letter))
+        {
+            break;
+        }
+        journal->pop();
+        budget -= 1.0;
+        ++replayed;
+    }
+
+    mReplayed[destination] += replayed;
+    mReplayedSinceStatus[destination] += replayed;
+
+    if(journal->empty())
+    {
+        removeJournal(it);
+    }
+    return replayed;
+}
+
+std::vector<SpoolStatus> LetterSpool::getStatus(const base::Time& now)
+{
+    double period = mLastStatus.isNull() ? 0.0 : (now - mLastStatus).toSeconds();
+
+    std::vector<SpoolStatus> status;
+    for(Journals::const_iterator it = mJournals.begin(); it != mJournals.end(); ++it)
+    {
+        LetterJournal* journal = it->second;
+
+        SpoolStatus journalStatus;
+        journalStatus.destination = it->first;
+        journalStatus.letters = journal->getLetterCount();
+        journalStatus.bytes = journal->getByteCount();
+        journalStatus.dropped = journal->getDroppedCount() + mExpired[it->first];
+        journalStatus.replayed = mReplayed[it->first];
+        if(period > 0)
+        {
+            journalStatus.replay_rate = mReplayedSinceStatus[it->first] / period;
+        }
+
+        fipa::SerializedLetter letter;
+        journal->front(letter, journalStatus.oldest);
+
+        status.push_back(journalStatus);
+    }
+
+    mReplayedSinceStatus.clear();
+    mLastStatus = now;
+    return status;
+}
+
+} // namespace fipa_services
@@ -0,0 +1,235 @@
+#ifndef FIPA_SERVICES_LETTER_SPOOL_HPP
+#define FIPA_SERVICES_LETTER_SPOOL_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+#include <boost/function.hpp>
+#include <base/Time.hpp>
+#include <fipa_acl/message_generator/serialized_letter.h>
+#include "fipa_servicesTypes.hpp"
+
+namespace fipa_services {
+
+    /**
+     * \class LetterJournal
+     * \brief Memory-mapped journal of serialized letters for a single destination
+     * \details The journal is a file of fixed size which is mapped into memory.
+     * Letters are appended at the tail and consumed from the head, so that the
+     * order of the letters is preserved. When the journal is full, the oldest
+     * letters are dropped to make room for new ones.
+     * Since the journal is backed by a file, it survives a restart of the component.
+     * A restored journal is checked for consistency and reset if it is corrupted,
+     * letters of a journal with a different size are carried over.
+     */
+    class LetterJournal
+    {
+    public:
+        /**
+         * Open an existing or create a new journal
+         * \param filename Path to the journal file
+         * \param destination Name of the destination the letters are spooled for
+         * \param maxSize Size of the journal file in bytes (including the journal header)
+         * \throws std::runtime_error if the journal cannot be created or mapped
+         */
+        LetterJournal(const std::string& filename, const std::string& destination, uint32_t maxSize);
+
+        ~LetterJournal();
+
+        /**
+         * Append a letter to the journal, dropping the oldest letters if necessary
+         * \return false if the letter exceeds the size of the journal, true otherwise
+         */
+        bool append(const fipa::SerializedLetter& letter, const base::Time& timestamp);
+
+        /**
+         * Retrieve the oldest letter without removing it
+         * \return false if the journal is empty, true otherwise
+         */
+        bool front(fipa::SerializedLetter& letter, base::Time& timestamp);
+
+        /**
+         * Remove the oldest letter
+         */
+        void pop();
+
+        /**
+         * Drop all letters which are older than the given maximum age
+         * \return number of dropped letters
+         */
+        uint32_t expire(const base::Time& now, const base::Time& maxAge);
+
+        /**
+         * Get the name of the destination this journal belongs to
+         */
+        const std::string& getDestination() const { return mDestination; }
+
+        /**
+         * Get the number of letters in the journal
+         */
+        uint32_t getLetterCount() const;
+
+        /**
+         * Get the number of bytes occupied by letters in the journal
+         */
+        uint32_t getByteCount() const;
+
+        /**
+         * Get the number of letters that have been dropped due to the size limit
+         */
+        uint32_t getDroppedCount() const { return mDropped; }
+
+        bool empty() const { return getLetterCount() == 0; }
+
+        /**
+         * Read the destination name from an existing journal file
+         * \return false if the file is not a valid journal, true otherwise
+         */
+        static bool readDestination(const std::string& filename, std::string& destination);
+
+    private:
+        struct Header;
+        struct RecordHeader;
+        typedef std::vector< std::pair<fipa::SerializedLetter, base::Time> > SpooledLetters;
+
+        Header* header() const;
+        void reset();
+        void compact();
+
+        /**
+         * Read the header of the record at the given offset
+         * \return false if the record exceeds the tail of the journal
+         */
+        bool readRecord(uint32_t offset, RecordHeader& record) const;
+
+        /**
+         * Read the header of the oldest record; the journal is reset if the
+         * record is inconsistent
+         * \return false if the journal has been reset, true otherwise
+         */
+        bool readHead(RecordHeader& record);
+
+        /**
+         * Check that the records between head and tail are consistent with
+         * the journal header
+         */
+        bool validate() const;
+
+        /**
+         * Read all letters from an existing journal file of the given size
+         */
+        static SpooledLetters readLetters(const std::string& filename, const std::string& destination, off_t size);
+
+        std::string mFilename;
+        std::string mDestination;
+        int mFileDescriptor;
+        uint8_t* mData;
+        uint32_t mSize;
+        uint32_t mDropped;
+    };
+
+    /**
+     * \class LetterSpool
+     * \brief Store-and-forward spool for letters to receivers which are currently unreachable
+     * \details The spool maintains one LetterJournal per destination with pending letters
+     * in the given directory. A journal is unmapped and removed once replay or expiry
+     * has emptied it. Non-empty journals found in this directory are restored when the
+     * spool is created.
+     * Replay of spooled letters is limited by a rate per destination (token bucket)
+     * so that the link is not flooded when a peer reappears. Letters arriving for a
+     * destination while its backlog is replayed are appended to the backlog (see
+     * queue) and add to the replay budget, so that all letters are delivered in
+     * order and the backlog drains at the replay rate on top of the arrival rate.
+     */
+    class LetterSpool
+    {
+    public:
+        /// Handler for replaying a letter, returns false if the letter could not be handled
+        typedef boost::function1<bool, const fipa::SerializedLetter&> ReplayHandler;
+
+        /**
+         * \param directory Directory the journals are stored in; will be created if it does not exist
+         * \param maxJournalSize Maximum size of a journal per destination in bytes
+         * \param maxAge Maximum age of spooled letters; letters are dropped when exceeding this age, a null time disables the age limit
+         * \param replayRate Maximum number of letters per second that are replayed per destination
+         * \throws std::runtime_error if the directory cannot be created
+         */
+        LetterSpool(const std::string& directory, uint32_t maxJournalSize, const base::Time& maxAge, double replayRate);
+
+        ~LetterSpool();
+
+        /**
+         * Store a letter for a destination
+         * \return true if the letter has been spooled, false otherwise
+         */
+        bool store(const std::string& destination, const fipa::SerializedLetter& letter, const base::Time& now);
+
+        /**
+         * Append a letter to the backlog of a reachable destination and
+         * increase its replay budget by one letter
+         * \return true if the letter has been spooled, false otherwise
+         */
+        bool queue(const std::string& destination, const fipa::SerializedLetter& letter, const base::Time& now);
+
+        /**
+         * Check whether letters are pending for the given destination
+         */
+        bool hasPending(const std::string& destination) const;
+
+        /**
+         * Get the list of destinations with pending letters
+         */
+        std::vector<std::string> getPendingDestinations() const;
+
+        /**
+         * Refill the replay budgets and drop letters exceeding the maximum age
+         */
+        void update(const base::Time& now);
+
+        /**
+         * Replay letters for the given destination in order, as long as the
+         * replay budget of the destination permits
+         * \return number of replayed letters
+         */
+        uint32_t replay(const std::string& destination, ReplayHandler handler);
+
+        /**
+         * Get the status of all journals; the replay rate is computed over
+         * the period since the last call of this function
+         */
+        std::vector<SpoolStatus> getStatus(const base::Time& now);
+
+    private:
+        typedef std::map<std::string, LetterJournal*> Journals;
+
+        LetterJournal* getJournal(const std::string& destination);
+        std::string getJournalFilename(const std::string& destination) const;
+        void restore();
+
+        /**
+         * Unmap and delete the journal file of a destination without
+         * pending letters
+         */
+        void removeJournal(Journals::iterator it);
+
+        std::string mDirectory;
+        uint32_t mMaxJournalSize;
+        base::Time mMaxAge;
+        double mReplayRate;
+
+        Journals mJournals;
+
+        std::map<std::string, double> mReplayBudgets;
+        base::Time mLastUpdate;
+
+        base::Time mLastStatus;
+        std::map<std::string, uint32_t> mExpired;
+        std::map<std::string, uint32_t> mReplayed;
+        std::map<std::string, uint32_t> mReplayedSinceStatus;
+    };
+
+} // namespace fipa_services
+
+#endif // FIPA_SERVICES_LETTER_SPOOL_HPP
@@ -1,9 +1,16 @@
 #include "MessageTransportTask.hpp"
+#include "LetterSpool.hpp"
+#include "LetterCapture.hpp"
+#include "FrameCoalescer.hpp"
+#include "MulticastChannel.hpp"
+#include "Tracing.hpp"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
+#include <stdexcept>
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/assign/list_of.hpp>
@@ -20,6 +27,19 @@
 
 namespace rc = RTT::corba;
 
+namespace {
+
+    /**
+     * Check whether a receiver name is a regular expression, i.e. addresses
+     * a group of receivers rather than a single one
+     */
+    bool isReceiverPattern(const std::string& receiver)
+    {
+        return receiver.find_first_of("*+?[]()|^$\\") != std::string::npos;
+    }
+
+} // end anonymous namespace
+
 using namespace RTT;
 
 namespace fipa_services
@@ -30,6 +50,11 @@ namespace fipa_services
 MessageTransportTask::MessageTransportTask(std::string const& name)
     : MessageTransportTaskBase(name)
     , mMessageTransport(0)
+    , mMaxDirectoryUpdates(0)
+    , mLetterSpool(0)
+    , mLetterCapture(0)
+    , mFrameCoalescer(0)
+    , mMulticastChannel(0)
 {
     initializeMessageTransport();
 }
@@ -37,12 +62,22 @@ MessageTransportTask::MessageTransportTask(std::string const& name)
 MessageTransportTask::MessageTransportTask(std::string const& name, RTT::ExecutionEngine* engine)
     : MessageTransportTaskBase(name, engine)
     , mMessageTransport(0)
+    , mMaxDirectoryUpdates(0)
+    , mLetterSpool(0)
+    , mLetterCapture(0)
+    , mFrameCoalescer(0)
+    , mMulticastChannel(0)
 {
     initializeMessageTransport();
 }
 
 MessageTransportTask::~MessageTransportTask()
-{}
+{
+    delete mLetterSpool;
+    delete mLetterCapture;
+    delete mFrameCoalescer;
+    delete mMulticastChannel;
+}
 
 void MessageTransportTask::initializeMessageTransport()
 {
@@ -105,16 +140,73 @@ bool MessageTransportTask::configureHook()
         mExtraServiceDirectoryEntries.push_back(entry);
     }
 
-    // Create the output ports for known local receivers
-    // This will create the necessary set of output ports
-    std::vector<std::string> localReceivers = _local_receivers.get();
-    for(std::vector<std::string>::const_iterator it = localReceivers.begin(); it != localReceivers.end(); ++it)
+    // Store-and-forward spool for letters to unreachable receivers
+    std::string spoolDirectory = _spool_directory.get();
+    if(!spoolDirectory.empty())
+    {
+        try {
+            mLetterSpool = new LetterSpool(spoolDirectory, _spool_max_size.get(), ::base::Time::fromSeconds(_spool_max_age.get()), _spool_replay_rate.get());
+        } catch(const std::runtime_error& e)
+        {
+            RTT::log(RTT::Error) << "MessageTransportTask '" << getName() << "' : creating spool failed: " << e.what() << RTT::endlog();
+            releaseOptionalFeatures();
+            return false;
+        }
+        RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : spooling letters for unreachable receivers in '" << spoolDirectory << "'" << RTT::endlog();
+    }
+
+    // Coalescing of small letters into frames
+    std::vector<FrameConfiguration> frameConfigurations = _frame_configurations.get();
+    if(!frameConfigurations.empty())
+    {
+        mFrameCoalescer = new FrameCoalescer(frameConfigurations);
+    }
+
+    // Multicast fan-out
+    MulticastConfiguration multicastConfiguration = _multicast_configuration.get();
+    if(!multicastConfiguration.group.empty())
     {
-        if( !addReceiver(*it, true) )
+        uuid_t uuid;
+        uuid_generate(uuid);
+        char channelUID[512];
+        uuid_unparse(uuid, channelUID);
+
+        try {
+            mMulticastChannel = new MulticastChannel(multicastConfiguration, getName() + "-" + std::string(channelUID));
+        } catch(const std::runtime_error& e)
         {
-            RTT::log(RTT::Error) << "MessageTransportTask '" << getName() << "'" << ": adding output port for local receiver '" << *it << "' failed" << RTT::endlog();
+            RTT::log(RTT::Error) << "MessageTransportTask '" << getName() << "' : creating multicast channel failed: " << e.what() << RTT::endlog();
+            releaseOptionalFeatures();
             return false;
         }
+        RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : joined multicast group '" << multicastConfiguration.group << ":" << multicastConfiguration.port << "'" << RTT::endlog();
+    }
+
+    // Capture of ingress letters
+    std::string captureFile = _capture_file.get();
+    if(!captureFile.empty())
+    {
+        try {
+            mLetterCapture = new LetterCapture(captureFile);
+        } catch(const std::runtime_error& e)
+        {
+            RTT::log(RTT::Error) << "MessageTransportTask '" << getName() << "' : creating capture failed: " << e.what() << RTT::endlog();
+            releaseOptionalFeatures();
+            return false;
+        }
+        RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : capturing letters to '" << captureFile << "'" << RTT::endlog();
+    }
+
+    mMaxDirectoryUpdates = _max_directory_updates.get();
+
+    // Create the output ports for known local receivers
+    // This will create the necessary set of output ports
+    std::vector<std::string> localReceivers = _local_receivers.get();
+    if( !addReceivers(localReceivers, true) )
+    {
+        RTT::log(RTT::Error) << "MessageTransportTask '" << getName() << "'" << ": adding output ports for local receivers failed" << RTT::endlog();
+        releaseOptionalFeatures();
+        return false;
     }
 
     return true;
@@ -145,31 +237,108 @@ void MessageTransportTask::updateHook()
 {
     using namespace fipa::acl;
 
+    FIPA_SERVICES_TRACE0(update_begin);
+
     // Handling the incoming letters from direct clients
     fipa::SerializedLetter serializedLetter;
     while( _letters.read(serializedLetter) == RTT::NewData)
     {
+        FIPA_SERVICES_TRACE1(letter_read, serializedLetter.data.size());
+
         _letters_debug.write(serializedLetter);
 
         RTT::log(RTT::Debug) << "MessageTransportTask '" << getName() << "' : received new letter of size '" << serializedLetter.getVector().size() << "'" << RTT::endlog();
 
         fipa::acl::Letter letter = serializedLetter.deserialize();
+        FIPA_SERVICES_TRACE_LETTER1(letter_deserialized, letter, serializedLetter.data.size());
 
         // Debugging
         fipa::acl::ACLBaseEnvelope be = letter.flattened();
         RTT::log(RTT::Debug) << "MessageTransportTask '" << getName() << "' : intended receivers: " << be.getIntendedReceivers() << ", content: " << letter.getACLMessage().getContent() << RTT::endlog();
 
+        if(mLetterCapture && !mLetterCapture->write(::base::Time::now(), be.getFrom().getName(), serializedLetter))
+        {
+            RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : capturing letter failed" << RTT::endlog();
+        }
+
         // Handle letter
-        mMessageTransport->handle(letter);
+        FIPA_SERVICES_TRACE_LETTER1(letter_handle_begin, letter, serializedLetter.data.size());
+        if(mLetterSpool)
+        {
+            handleWithSpool(serializedLetter, letter, be.getIntendedReceivers());
+        } else {
+            forwardLetter(serializedLetter, letter, be.getIntendedReceivers());
+        }
+        FIPA_SERVICES_TRACE_LETTER1(letter_handle_end, letter, serializedLetter.data.size());
+    }
+
+    // Announce added and removed receivers to the service directory
+    if(!mDirectoryUpdates.empty())
+    {
+        applyDirectoryUpdates(mMaxDirectoryUpdates ? mMaxDirectoryUpdates : mDirectoryUpdates.size());
+    }
+
+    if(mLetterSpool)
+    {
+        replaySpool();
+    }
+
+    if(mFrameCoalescer)
+    {
+        std::vector<Frame> frames;
+        mFrameCoalescer->flushExpired(::base::Time::now(), frames);
+        sendFrames(frames);
+    }
+
+    if(mMulticastChannel)
+    {
+        handleMulticast();
     }
 
     // trigger connection handling and message processing
+    FIPA_SERVICES_TRACE0(trigger_begin);
     mMessageTransport->trigger();
+    FIPA_SERVICES_TRACE0(trigger_end);
+
+    // Route the letters that arrived in frames for receivers of other MTS
+    if(!mUnpackedLetters.empty())
+    {
+        std::vector<fipa::SerializedLetter> unpackedLetters;
+        unpackedLetters.swap(mUnpackedLetters);
+        for(std::vector<fipa::SerializedLetter>::const_iterator it = unpackedLetters.begin(); it != unpackedLetters.end(); ++it)
+        {
+            fipa::acl::Letter letter;
+            try {
+                letter = it->deserialize();
+            } catch(const std::exception& e)
+            {
+                RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : dropping malformed letter from a frame: " << e.what() << RTT::endlog();
+                continue;
+            }
+            FIPA_SERVICES_TRACE_LETTER1(letter_handle_begin, letter, it->data.size());
+            mMessageTransport->handle(letter);
+            FIPA_SERVICES_TRACE_LETTER1(letter_handle_end, letter, it->data.size());
+        }
+    }
+
+    FIPA_SERVICES_TRACE0(update_end);
 }
 
 void MessageTransportTask::stopHook()
 {
     MessageTransportTaskBase::stopHook();
+
+    if(mLetterCapture)
+    {
+        mLetterCapture->flush();
+    }
+
+    if(mFrameCoalescer)
+    {
+        std::vector<Frame> frames;
+        mFrameCoalescer->flushAll(frames);
+        sendFrames(frames);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -181,12 +350,8 @@ void MessageTransportTask::cleanupHook()
     MessageTransportTaskBase::cleanupHook();
 
     // Explicitly deregister all services
-    std::vector<std::string> recvs = getReceivers();
-    for(std::vector<std::string>::const_iterator it = recvs.begin(); it != recvs.end(); it++)
-    {
-        removeReceiverPort(*it);
-        deregisterService(*it);
-    }
+    removeReceivers(getReceivers());
+    applyDirectoryUpdates(mDirectoryUpdates.size());
 
     // And deregister other known addresses
     for(std::vector<fipa::services::ServiceDirectoryEntry>::const_iterator it = mExtraServiceDirectoryEntries.begin(); it != mExtraServiceDirectoryEntries.end(); it++)
@@ -196,6 +361,39 @@ void MessageTransportTask::cleanupHook()
 
     delete mMessageTransport;
     mMessageTransport = NULL;
+
+    if(mLetterCapture)
+    {
+        RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : captured " << mLetterCapture->getLetterCount() << " letters" << RTT::endlog();
+    }
+
+    if(mFrameCoalescer)
+    {
+        RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : coalesced " << mFrameCoalescer->getLetterCount() << " letters into " << mFrameCoalescer->getFrameCount() << " frames" << RTT::endlog();
+    }
+
+    releaseOptionalFeatures();
+}
+
+void MessageTransportTask::releaseOptionalFeatures()
+{
+    delete mLetterSpool;
+    mLetterSpool = NULL;
+
+    delete mLetterCapture;
+    mLetterCapture = NULL;
+
+    delete mFrameCoalescer;
+    mFrameCoalescer = NULL;
+    mFramePeers.clear();
+    mUnpackedLetters.clear();
+
+    delete mMulticastChannel;
+    mMulticastChannel = NULL;
+    mMulticastReceivers.clear();
+    mSpoolReplaying.clear();
+    mReachability.clear();
+    mSpoolWakeups.clear();
 }
 
 bool MessageTransportTask::deliverLetterLocally(const std::string& receiverName, const fipa::acl::Letter& letter)
@@ -203,6 +401,15 @@ bool MessageTransportTask::deliverLetterLocally(const std::string& receiverName,
     // Local delivery
     RTT::log(RTT::Debug) << "MessageTransportTask: '" << getName() << "' delivery to local client" << RTT::endlog();
 
+    // Letters in a frame are unpacked and delivered separately
+    fipa::acl::ACLMessage message = letter.getACLMessage();
+    if(message.getProtocol() == FrameCoalescer::PROTOCOL)
+    {
+        return deliverFrame(receiverName, message.getContent());
+    }
+
+    FIPA_SERVICES_TRACE_LETTER1(local_delivery_begin, letter, receiverName.c_str());
+
     // Deliver the message to local clients, i.e. a corresponding receiver has a dedicated output port available on this MTS
     ReceiverPorts::iterator portsIt = mReceivers.find(receiverName);
     if(portsIt == mReceivers.end())
@@ -218,6 +425,7 @@ bool MessageTransportTask::deliverLetterLocally(const std::string& receiverName,
                 RTT::log(RTT::Warning) << "MessageTransportTask: '" << getName() << "' : client port to '" << receiverName << "' exists, but is not connected -- message not be processed by receiver" << RTT::endlog();
             }
             clientPort->write(serializedLetter);
+            FIPA_SERVICES_TRACE_LETTER2(local_delivery_end, letter, receiverName.c_str(), serializedLetter.data.size());
             return true;
         } else {
             RTT::log(RTT::Error) << "MessageTransportTask: '" << getName() << "' : internal error since client port could not be casted to expected type" << RTT::endlog();
@@ -227,6 +435,527 @@ bool MessageTransportTask::deliverLetterLocally(const std::string& receiverName,
     return false;
 }
 
+bool MessageTransportTask::deliverFrame(const std::string& receiverName, const std::string& frame)
+{
+    std::vector<fipa::SerializedLetter> serializedLetters;
+    if(!FrameCoalescer::unpack(frame, serializedLetters))
+    {
+        RTT::log(RTT::Error) << "MessageTransportTask: '" << getName() << "' : received malformed frame for '" << receiverName << "'" << RTT::endlog();
+        return false;
+    }
+
+    for(std::vector<fipa::SerializedLetter>::const_iterator it = serializedLetters.begin(); it != serializedLetters.end(); ++it)
+    {
+        fipa::acl::Letter letter;
+        try {
+            letter = it->deserialize();
+        } catch(const std::exception& e)
+        {
+            RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : dropping malformed letter from a frame: " << e.what() << RTT::endlog();
+            continue;
+        }
+
+        if(letter.getACLMessage().getProtocol() == FrameCoalescer::PROTOCOL)
+        {
+            RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : dropping frame nested in a frame" << RTT::endlog();
+            continue;
+        }
+
+        // Letters for local receivers are delivered right away, so that they
+        // are not overtaken by letters which arrive after the frame
+        fipa::acl::AgentIDList receivers = letter.flattened().getIntendedReceivers();
+        fipa::acl::AgentIDList forwardReceivers;
+        for(fipa::acl::AgentIDList::const_iterator rit = receivers.begin(); rit != receivers.end(); ++rit)
+        {
+            if(mReceivers.count(rit->getName()))
+            {
+                deliverLetterLocally(rit->getName(), letter);
+            } else {
+                forwardReceivers.push_back(*rit);
+            }
+        }
+
+        // Letters for receivers which are not attached to this MTS are routed
+        // once the message transport returns from trigger
+        if(forwardReceivers.size() == receivers.size())
+        {
+            mUnpackedLetters.push_back(*it);
+        } else if(!forwardReceivers.empty())
+        {
+            mUnpackedLetters.push_back(fipa::SerializedLetter(restrictReceivers(letter, forwardReceivers), it->representation));
+        }
+    }
+    return true;
+}
+
+fipa::acl::Letter MessageTransportTask::restrictReceivers(const fipa::acl::Letter& letter, const fipa::acl::AgentIDList& receivers) const
+{
+    fipa::acl::Letter restrictedLetter = letter;
+    fipa::acl::ACLBaseEnvelope extraEnvelope;
+    extraEnvelope.setIntendedReceivers(receivers);
+    restrictedLetter.addExtraEnvelope(extraEnvelope);
+    return restrictedLetter;
+}
+
+bool MessageTransportTask::isReachable(const std::string& receiver)
+{
+    if(mReceivers.count(receiver))
+    {
+        return true;
+    }
+
+    ::base::Time now = ::base::Time::now();
+
+    // Query the service directory at most once per second per receiver
+    Reachability::iterator it = mReachability.find(receiver);
+    if(it == mReachability.end() || (now - it->second.checked).toSeconds() >= 1.0)
+    {
+        fipa::services::ServiceDirectoryList entries = mMessageTransport->getServiceDirectory()->search(receiver, fipa::services::ServiceDirectoryEntry::NAME, false);
+        ReceiverReachability& reachability = mReachability[receiver];
+        reachability.reachable = !entries.empty();
+        reachability.checked = now;
+        return reachability.reachable;
+    }
+    return it->second.reachable;
+}
+
+void MessageTransportTask::handleWithSpool(const fipa::SerializedLetter& serializedLetter, const fipa::acl::Letter& letter, const fipa::acl::AgentIDList& receivers)
+{
+    ::base::Time now = ::base::Time::now();
+    fipa::acl::AgentIDList reachableReceivers;
+
+    fipa::acl::AgentIDList::const_iterator it = receivers.begin();
+    for(; it != receivers.end(); ++it)
+    {
+        const std::string& receiver = it->getName();
+        bool reachable = isReceiverPattern(receiver) || isReachable(receiver);
+        if(reachable && !mLetterSpool->hasPending(receiver))
+        {
+            reachableReceivers.push_back(*it);
+            continue;
+        }
+
+        fipa::SerializedLetter spoolLetter = serializedLetter;
+        if(receivers.size() != 1)
+        {
+            fipa::acl::AgentIDList spoolReceivers;
+            spoolReceivers.push_back(*it);
+            spoolLetter = fipa::SerializedLetter(restrictReceivers(letter, spoolReceivers), serializedLetter.representation);
+            spoolLetter.timestamp = serializedLetter.timestamp;
+        }
+
+        bool spooled = false;
+        if(reachable)
+        {
+            // New letters for a reachable receiver must not overtake its
+            // backlog, so they are appended to it and the replay is sped up
+            // accordingly
+            spooled = mLetterSpool->queue(receiver, spoolLetter, now);
+            startReplay(receiver);
+        } else {
+            // The journal of a receiver may have been emptied by expiry while
+            // it was replayed
+            mSpoolReplaying.erase(receiver);
+            spooled = mLetterSpool->store(receiver, spoolLetter, now);
+        }
+
+        if(spooled)
+        {
+            RTT::log(RTT::Debug) << "MessageTransportTask '" << getName() << "' : receiver '" << receiver << "' " << (reachable ? "has a backlog" : "is unreachable") << " -- spooled letter" << RTT::endlog();
+        } else {
+            // Let the message transport deal with it as if there was no spool
+            RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : spooling letter for receiver '" << receiver << "' failed" << RTT::endlog();
+            reachableReceivers.push_back(*it);
+        }
+    }
+
+    if(reachableReceivers.size() == receivers.size())
+    {
+        forwardLetter(serializedLetter, letter, receivers);
+    } else if(!reachableReceivers.empty())
+    {
+        flushFrames(reachableReceivers);
+        mMessageTransport->handle(restrictReceivers(letter, reachableReceivers));
+    }
+}
+
+void MessageTransportTask::forwardLetter(const fipa::SerializedLetter& serializedLetter, const fipa::acl::Letter& letter, const fipa::acl::AgentIDList& receivers)
+{
+    if(mFrameCoalescer && coalesceLetter(serializedLetter, receivers))
+    {
+        return;
+    }
+    flushFrames(receivers);
+
+    if(mMulticastChannel && multicastLetter(serializedLetter, letter, receivers))
+    {
+        return;
+    }
+    mMessageTransport->handle(letter);
+}
+
+bool MessageTransportTask::multicastLetter(const fipa::SerializedLetter& serializedLetter, const fipa::acl::Letter& letter, const fipa::acl::AgentIDList& receivers)
+{
+    // The letter sent via multicast is larger than the original one due to
+    // the additional envelope, so this is only a first check
+    const MulticastConfiguration& configuration = mMulticastChannel->getConfiguration();
+    if(mMulticastReceivers.empty() || serializedLetter.getVector().size() > configuration.max_payload)
+    {
+        return false;
+    }
+
+    // Only letters of protocols which tolerate loss are sent via multicast
+    std::string protocol = letter.getACLMessage().getProtocol();
+    if(std::find(configuration.protocols.begin(), configuration.protocols.end(), protocol) == configuration.protocols.end())
+    {
+        return false;
+    }
+
+    // Resolve the receivers -- patterns are resolved via the service directory
+    std::map<std::string, fipa::acl::AgentID> resolvedReceivers;
+    fipa::acl::AgentIDList::const_iterator it = receivers.begin();
+    for(; it != receivers.end(); ++it)
+    {
+        if(isReceiverPattern(it->getName()))
+        {
+            fipa::services::ServiceDirectoryList entries = mMessageTransport->getServiceDirectory()->search(it->getName(), fipa::services::ServiceDirectoryEntry::NAME, false);
+            for(fipa::services::ServiceDirectoryList::const_iterator eit = entries.begin(); eit != entries.end(); ++eit)
+            {
+                resolvedReceivers.insert(std::make_pair(eit->getName(), fipa::acl::AgentID(eit->getName())));
+            }
+        } else {
+            resolvedReceivers.insert(std::make_pair(it->getName(), *it));
+        }
+    }
+
+    ::base::Time now = ::base::Time::now();
+    double peerTimeout = configuration.peer_timeout;
+
+    std::set<std::string> peers;
+    fipa::acl::AgentIDList multicastReceivers;
+    fipa::acl::AgentIDList unicastReceivers;
+    std::map<std::string, fipa::acl::AgentID>::const_iterator rit = resolvedReceivers.begin();
+    for(; rit != resolvedReceivers.end(); ++rit)
+    {
+        MulticastReceivers::const_iterator mit = mMulticastReceivers.find(rit->first);
+        if(!mReceivers.count(rit->first) && mit != mMulticastReceivers.end() && (now - mit->second.last_seen).toSeconds() <= peerTimeout)
+        {
+            multicastReceivers.push_back(rit->second);
+            peers.insert(mit->second.peer);
+        } else {
+            unicastReceivers.push_back(rit->second);
+        }
+    }
+
+    if(peers.size() < configuration.min_peers)
+    {
+        return false;
+    }
+
+    fipa::SerializedLetter multicastLetter(restrictReceivers(letter, multicastReceivers), serializedLetter.representation);
+    multicastLetter.timestamp = serializedLetter.timestamp;
+    if(!mMulticastChannel->fits(multicastLetter))
+    {
+        RTT::log(RTT::Debug) << "MessageTransportTask '" << getName() << "' : letter exceeds the multicast payload -- sending via unicast" << RTT::endlog();
+        return false;
+    }
+
+    if(!mMulticastChannel->sendLetter(multicastLetter))
+    {
+        RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : sending letter via multicast failed -- falling back to unicast" << RTT::endlog();
+        return false;
+    }
+    RTT::log(RTT::Debug) << "MessageTransportTask '" << getName() << "' : sent letter via multicast to " << multicastReceivers.size() << " receivers on " << peers.size() << " MTS" << RTT::endlog();
+
+    if(!unicastReceivers.empty())
+    {
+        mMessageTransport->handle(restrictReceivers(letter, unicastReceivers));
+    }
+    return true;
+}
+
+void MessageTransportTask::handleMulticast()
+{
+    ::base::Time now = ::base::Time::now();
+    const MulticastConfiguration& configuration = mMulticastChannel->getConfiguration();
+
+    if((now - mLastMulticastBeacon).toSeconds() >= configuration.beacon_interval)
+    {
+        if(!mMulticastChannel->sendBeacon(getReceivers()))
+        {
+            RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : sending multicast beacon failed" << RTT::endlog();
+        }
+        mLastMulticastBeacon = now;
+
+        // Forget receivers that have not been announced recently
+        MulticastReceivers::iterator it = mMulticastReceivers.begin();
+        while(it != mMulticastReceivers.end())
+        {
+            if((now - it->second.last_seen).toSeconds() > configuration.peer_timeout)
+            {
+                mMulticastReceivers.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    MulticastChannel::Datagram datagram;
+    while(mMulticastChannel->receive(datagram))
+    {
+        if(datagram.type == MulticastChannel::BEACON)
+        {
+            for(std::vector<std::string>::const_iterator it = datagram.receivers.begin(); it != datagram.receivers.end(); ++it)
+            {
+                MulticastReceiver& receiver = mMulticastReceivers[*it];
+                receiver.peer = datagram.sender;
+                receiver.last_seen = now;
+            }
+            continue;
+        }
+
+        fipa::acl::Letter letter;
+        try {
+            letter = datagram.letter.deserialize();
+        } catch(const std::exception& e)
+        {
+            RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : received malformed letter via multicast from '" << datagram.sender << "': " << e.what() << RTT::endlog();
+            continue;
+        }
+
+        // Each MTS in the group delivers to its own local receivers only
+        fipa::acl::AgentIDList receivers = letter.flattened().getIntendedReceivers();
+        for(fipa::acl::AgentIDList::const_iterator it = receivers.begin(); it != receivers.end(); ++it)
+        {
+            if(mReceivers.count(it->getName()))
+            {
+                deliverLetterLocally(it->getName(), letter);
+            }
+        }
+    }
+}
+
+bool MessageTransportTask::coalesceLetter(const fipa::SerializedLetter& serializedLetter, const fipa::acl::AgentIDList& receivers)
+{
+    // Only letters to a single remote receiver are coalesced
+    if(receivers.size() != 1)
+    {
+        return false;
+    }
+
+    const std::string& receiver = receivers.front().getName();
+    if(isReceiverPattern(receiver))
+    {
+        return false;
+    }
+
+    if(mReceivers.count(receiver))
+    {
+        return false;
+    }
+
+    std::string peer;
+    fipa::services::transports::Type transportType;
+    if(!resolvePeer(receiver, peer, transportType))
+    {
+        return false;
+    }
+
+    const FrameConfiguration* configuration = mFrameCoalescer->getConfiguration(transportType);
+    if(!configuration)
+    {
+        return false;
+    }
+
+    if(serializedLetter.getVector().size() > configuration->max_letter_size)
+    {
+        return false;
+    }
+
+    std::vector<Frame> frames;
+    mFrameCoalescer->add(peer, receiver, *configuration, serializedLetter, ::base::Time::now(), frames);
+    sendFrames(frames);
+    return true;
+}
+
+bool MessageTransportTask::resolvePeer(const std::string& receiver, std::string& address, fipa::services::transports::Type& transportType)
+{
+    ::base::Time now = ::base::Time::now();
+
+    // Resolve at most once per second per receiver
+    FramePeers::iterator it = mFramePeers.find(receiver);
+    if(it == mFramePeers.end() || (now - it->second.resolved).toSeconds() >= 1.0)
+    {
+        FramePeer peer;
+        peer.resolved = now;
+        peer.valid = false;
+
+        // Only MTS announcing the support for frames are considered -- all
+        // receivers of an MTS share its transport address
+        fipa::services::ServiceDirectoryList entries = mMessageTransport->getServiceDirectory()->search(receiver, fipa::services::ServiceDirectoryEntry::NAME, false);
+        if(!entries.empty() && FrameCoalescer::isSupported(entries.front().getDescription()))
+        {
+            std::vector<fipa::services::ServiceLocation> locations = entries.front().getLocator().getLocations();
+            if(!locations.empty())
+            {
+                // Addresses have the format 'udt://IP:port'
+                peer.address = locations.front().getServiceAddress();
+                std::string scheme = boost::to_upper_copy(peer.address.substr(0, peer.address.find("://")));
+                if(scheme == "UDT")
+                {
+                    peer.transport_type = fipa::services::transports::UDT;
+                    peer.valid = true;
+                } else if(scheme == "TCP")
+                {
+                    peer.transport_type = fipa::services::transports::TCP;
+                    peer.valid = true;
+                }
+            }
+        }
+        it = mFramePeers.insert(std::make_pair(receiver, peer)).first;
+        it->second = peer;
+    }
+
+    address = it->second.address;
+    transportType = it->second.transport_type;
+    return it->second.valid;
+}
+
+void MessageTransportTask::sendFrames(const std::vector<Frame>& frames)
+{
+    for(std::vector<Frame>::const_iterator it = frames.begin(); it != frames.end(); ++it)
+    {
+        if(it->letters == 1)
+        {
+            mMessageTransport->handle(it->first.deserialize());
+            continue;
+        }
+
+        // The letters of a frame are unpacked by the MTS of any of its
+        // receivers, so it is addressed to one which is still known
+        std::string receiver = it->receivers.back();
+        for(std::vector<std::string>::const_iterator rit = it->receivers.begin(); rit != it->receivers.end(); ++rit)
+        {
+            if(isReachable(*rit))
+            {
+                receiver = *rit;
+                break;
+            }
+        }
+
+        RTT::log(RTT::Debug) << "MessageTransportTask '" << getName() << "' : sending frame of " << it->letters << " letters (" << it->data.size() << " bytes) to '" << it->peer << "' via '" << receiver << "'" << RTT::endlog();
+
+        fipa::acl::ACLMessage message;
+        message.setPerformative(fipa::acl::ACLMessage::INFORM);
+        message.setProtocol(FrameCoalescer::PROTOCOL);
+        message.setSender(fipa::acl::AgentID(getName()));
+        message.addReceiver(fipa::acl::AgentID(receiver));
+        message.setContent(std::string(it->data.begin(), it->data.end()));
+
+        fipa::acl::Letter frameLetter(message, fipa::acl::representation::BITEFFICIENT);
+        mMessageTransport->handle(frameLetter);
+    }
+}
+
+void MessageTransportTask::flushFrames(const fipa::acl::AgentIDList& receivers)
+{
+    if(!mFrameCoalescer || mFrameCoalescer->empty())
+    {
+        return;
+    }
+
+    std::vector<Frame> frames;
+    for(fipa::acl::AgentIDList::const_iterator it = receivers.begin(); it != receivers.end(); ++it)
+    {
+        if(isReceiverPattern(it->getName()))
+        {
+            // The receivers matching a pattern are resolved by the message transport
+            mFrameCoalescer->flushAll(frames);
+            break;
+        }
+
+        std::string peer;
+        fipa::services::transports::Type transportType;
+        if(resolvePeer(it->getName(), peer, transportType))
+        {
+            mFrameCoalescer->flushPeer(peer, frames);
+        }
+    }
+    sendFrames(frames);
+}
+
+void MessageTransportTask::replaySpool()
+{
+    ::base::Time now = ::base::Time::now();
+    mLetterSpool->update(now);
+
+    std::set<std::string> wakeups;
+    wakeups.swap(mSpoolWakeups);
+
+    // Reachability of spooled receivers is checked when they are added as
+    // local receivers or at a low rate
+    bool periodicCheck = (now - mLastSpoolCheck).toSeconds() >= 1.0;
+    if(periodicCheck)
+    {
+        mLastSpoolCheck = now;
+    }
+
+    std::vector<std::string> destinations = mLetterSpool->getPendingDestinations();
+    for(std::vector<std::string>::const_iterator it = destinations.begin(); it != destinations.end(); ++it)
+    {
+        const std::string& destination = *it;
+        if(periodicCheck || wakeups.count(destination))
+        {
+            if(isReachable(destination))
+            {
+                startReplay(destination);
+            } else {
+                mSpoolReplaying.erase(destination);
+            }
+        }
+
+        if(mSpoolReplaying.count(destination))
+        {
+            mLetterSpool->replay(destination, boost::bind(&MessageTransportTask::replayLetter, this, _1));
+            if(!mLetterSpool->hasPending(destination))
+            {
+                RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : replay of spooled letters for '" << destination << "' completed" << RTT::endlog();
+                mSpoolReplaying.erase(destination);
+            }
+        }
+    }
+
+    if((now - mLastSpoolStatus).toSeconds() >= 1.0)
+    {
+        _spool_status.write(mLetterSpool->getStatus(now));
+        mLastSpoolStatus = now;
+    }
+}
+
+void MessageTransportTask::startReplay(const std::string& destination)
+{
+    if(mSpoolReplaying.insert(destination).second)
+    {
+        RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : receiver '" << destination << "' is reachable -- replaying spooled letters" << RTT::endlog();
+    }
+}
+
+bool MessageTransportTask::replayLetter(const fipa::SerializedLetter& serializedLetter)
+{
+    fipa::acl::Letter letter;
+    try {
+        letter = serializedLetter.deserialize();
+    } catch(const std::exception& e)
+    {
+        // Drop the letter, so that the replay does not get stuck
+        RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : dropping malformed spooled letter: " << e.what() << RTT::endlog();
+        return true;
+    }
+    flushFrames(letter.flattened().getIntendedReceivers());
+    mMessageTransport->handle(letter);
+    return true;
+}
+
 ////////////////////////////////RPC-METHODS//////////////////////////
 std::vector<std::string> MessageTransportTask::getReceivers()
 {
@@ -241,37 +970,92 @@ std::vector<std::string> MessageTransportTask::getReceivers()
 
 bool MessageTransportTask::addReceiver(::std::string const & receiver, bool is_local)
 {
-    RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : adding receiver '" << receiver << "'" << RTT::endlog();
-    std::string output_port_name(receiver);
+    return addReceivers(std::vector<std::string>(1, receiver), is_local);
+}
+
+bool MessageTransportTask::addReceivers(::std::vector< ::std::string > const & receivers, bool is_local)
+{
+    RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : adding " << receivers.size() << " receiver(s)" << RTT::endlog();
 
-    RTT::base::PortInterface *pi = ports()->getPort(receiver);
-    if(pi) // we are already having a connection of the given name
+    // Create all ports upfront, so that the receivers are only locked while
+    // the ports are added
+    bool success = true;
+    std::vector<RTT::base::OutputPortInterface*> outputPorts;
+    for(std::vector<std::string>::const_iterator it = receivers.begin(); it != receivers.end(); ++it)
     {
-        RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : receiver port '" << receiver << "' already exists. Will reuse the port" << RTT::endlog();
-        // Since the receiver port already exists, we assume everything is good
-        return true;
+        RTT::base::PortInterface* port = _letters.antiClone();
+        port->setName(*it);
+
+        RTT::base::OutputPortInterface *out_port = dynamic_cast<RTT::base::OutputPortInterface*>(port);
+        if(!out_port)
+        {
+            RTT::log(RTT::Error) << "MessageTransportTask '" << getName() << "' : could not cast anticlone to outputport" << RTT::endlog();
+            delete port;
+            success = false;
+            continue;
+        }
+        outputPorts.push_back(out_port);
     }
 
-    RTT::base::PortInterface* port = _letters.antiClone();
-    port->setName(receiver);
+    std::vector<std::string> addedReceivers = addReceiverPorts(outputPorts);
 
-    RTT::base::OutputPortInterface *out_port = dynamic_cast<RTT::base::OutputPortInterface*>(port);
-    if(!out_port)
+    // The service directory has no batch registration, so each receiver is
+    // announced individually -- from updateHook at a limited rate
+    if(is_local)
     {
-        RTT::log(RTT::Error) << "MessageTransportTask '" << getName() << "' : could not cast anticlone to outputport" << RTT::endlog();
-        return false;
+        for(std::vector<std::string>::const_iterator it = addedReceivers.begin(); it != addedReceivers.end(); ++it)
+        {
+            queueDirectoryUpdate(*it, true);
+        }
     }
 
-    bool success = addReceiverPort(out_port, receiver);
-
-    if(success && is_local)
+    if(mLetterSpool)
     {
-        registerService(receiver);
+        mSpoolWakeups.insert(addedReceivers.begin(), addedReceivers.end());
     }
 
     return success;
 }
 
+void MessageTransportTask::queueDirectoryUpdate(const std::string& receiver, bool registration)
+{
+    for(DirectoryUpdates::iterator it = mDirectoryUpdates.begin(); it != mDirectoryUpdates.end(); ++it)
+    {
+        if(it->receiver == receiver)
+        {
+            // A registration and a deregistration which are both pending
+            // cancel each other
+            bool cancelled = it->registration != registration;
+            mDirectoryUpdates.erase(it);
+            if(cancelled)
+            {
+                return;
+            }
+            break;
+        }
+    }
+
+    DirectoryUpdate update;
+    update.receiver = receiver;
+    update.registration = registration;
+    mDirectoryUpdates.push_back(update);
+}
+
+void MessageTransportTask::applyDirectoryUpdates(size_t maxUpdates)
+{
+    for(size_t i = 0; i < maxUpdates && !mDirectoryUpdates.empty(); ++i)
+    {
+        DirectoryUpdate update = mDirectoryUpdates.front();
+        mDirectoryUpdates.pop_front();
+        if(update.registration)
+        {
+            registerService(update.receiver);
+        } else {
+            deregisterService(update.receiver);
+        }
+    }
+}
+
 void MessageTransportTask::deregisterService(std::string receiver)
 {
     try
@@ -288,49 +1072,77 @@ void MessageTransportTask::deregisterService(std::string receiver)
 void MessageTransportTask::registerService(std::string receiver)
 {
     RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : registering service '" << receiver << "'" << RTT::endlog();
-    mMessageTransport->registerClient(receiver, "Message client of " + getName());
+    mMessageTransport->registerClient(receiver, FrameCoalescer::announceSupport("Message client of " + getName()));
 }
 
 
 bool MessageTransportTask::removeReceiver(::std::string const & receiver)
 {
-    using namespace fipa::services;
-    if(removeReceiverPort(receiver))
+    return removeReceivers(std::vector<std::string>(1, receiver));
+}
+
+bool MessageTransportTask::removeReceivers(::std::vector< ::std::string > const & receivers)
+{
+    std::vector<std::string> removedReceivers = removeReceiverPorts(receivers);
+    for(std::vector<std::string>::const_iterator it = removedReceivers.begin(); it != removedReceivers.end(); ++it)
     {
-        deregisterService(receiver);
-        return true;
+        queueDirectoryUpdate(*it, false);
     }
 
-    return false;
+    return removedReceivers.size() == receivers.size();
 }
 
-bool MessageTransportTask::addReceiverPort(RTT::base::OutputPortInterface* outputPort, const std::string& receiver)
+std::vector<std::string> MessageTransportTask::addReceiverPorts(const std::vector<RTT::base::OutputPortInterface*>& outputPorts)
 {
     boost::unique_lock<boost::shared_mutex> lock(mServiceChangeMutex);
 
-    ports()->addPort(outputPort->getName(), *outputPort);
-    mReceivers[receiver] = outputPort;
-    RTT::log(RTT::Debug) << "MessageTransportTask '" << getName() << "' : Receiver port '" << receiver << "' added" << RTT::endlog();
-    return true;
+    std::vector<std::string> addedReceivers;
+    for(std::vector<RTT::base::OutputPortInterface*>::const_iterator it = outputPorts.begin(); it != outputPorts.end(); ++it)
+    {
+        std::string receiver = (*it)->getName();
+        if(ports()->getPort(receiver)) // we are already having a connection of the given name
+        {
+            RTT::log(RTT::Warning) << "MessageTransportTask '" << getName() << "' : receiver port '" << receiver << "' already exists. Will reuse the port" << RTT::endlog();
+            delete *it;
+            continue;
+        }
+
+        ports()->addPort(receiver, **it);
+        mReceivers[receiver] = *it;
+        addedReceivers.push_back(receiver);
+        RTT::log(RTT::Debug) << "MessageTransportTask '" << getName() << "' : Receiver port '" << receiver << "' added" << RTT::endlog();
+    }
+    return addedReceivers;
 }
 
-bool MessageTransportTask::removeReceiverPort(const std::string& receiver)
+std::vector<std::string> MessageTransportTask::removeReceiverPorts(const std::vector<std::string>& receivers)
 {
-    boost::unique_lock<boost::shared_mutex> lock(mServiceChangeMutex);
-
-    ReceiverPorts::iterator it = mReceivers.find(receiver);
-    if(it != mReceivers.end())
+    std::vector<std::string> removedReceivers;
+    std::vector<RTT::base::OutputPortInterface*> removedPorts;
     {
-        ports()->removePort(it->second->getName());
-        delete it->second;
-        mReceivers.erase(it);
+        boost::unique_lock<boost::shared_mutex> lock(mServiceChangeMutex);
 
-        return true;
+        for(std::vector<std::string>::const_iterator rit = receivers.begin(); rit != receivers.end(); ++rit)
+        {
+            ReceiverPorts::iterator it = mReceivers.find(*rit);
+            if(it != mReceivers.end())
+            {
+                ports()->removePort(it->second->getName());
+                removedPorts.push_back(it->second);
+                removedReceivers.push_back(it->first);
+                mReceivers.erase(it);
+            } else {
+                RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : No output port named '" << *rit << "' registered" << RTT::endlog();
+            }
+        }
     }
 
-    RTT::log(RTT::Info) << "MessageTransportTask '" << getName() << "' : No output port named '" << receiver << "' registered" << RTT::endlog();
-
-    return false;
+    // No letter can be delivered to these ports anymore
+    for(std::vector<RTT::base::OutputPortInterface*>::const_iterator it = removedPorts.begin(); it != removedPorts.end(); ++it)
+    {
+        delete *it;
+    }
+    return removedReceivers;
 }
 
 void MessageTransportTask::serviceAdded(servicediscovery::avahi::ServiceEvent se)
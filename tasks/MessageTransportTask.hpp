@@ -6,10 +6,14 @@
 #include "fipa_services/MessageTransportTaskBase.hpp"
 
 #include <map>
+#include <set>
+#include <deque>
 #include <vector>
 #include <boost/thread.hpp>
+#include <base/Time.hpp>
 #include <service_discovery/ServiceDiscovery.hpp>
 #include <fipa_services/ServiceDirectoryEntry.hpp>
+#include <fipa_services/transports/Configuration.hpp>
 
 namespace fipa {
 namespace services {
@@ -23,6 +27,11 @@ namespace services {
 } // namespace fipa
 
 namespace fipa_services {
+    class LetterSpool;
+    class LetterCapture;
+    class FrameCoalescer;
+    class MulticastChannel;
+    struct Frame;
 
     /*! \class MessageTransportTask
      * \brief The task context provides and requires services. It uses an ExecutionEngine to perform its functions.
@@ -80,9 +89,72 @@ namespace fipa_services {
         typedef std::map<std::string, RTT::base::OutputPortInterface*> ReceiverPorts;
         ReceiverPorts mReceivers;
 
+        // Pending (de)registrations of receivers with the service directory
+        struct DirectoryUpdate
+        {
+            std::string receiver;
+            bool registration;
+        };
+        typedef std::deque<DirectoryUpdate> DirectoryUpdates;
+        DirectoryUpdates mDirectoryUpdates;
+        // Maximum number of directory updates per update cycle (0 for no limit)
+        uint32_t mMaxDirectoryUpdates;
+
+        // Store-and-forward spool for letters to unreachable receivers (optional)
+        LetterSpool* mLetterSpool;
+        // Receivers for which the spool is currently replayed
+        std::set<std::string> mSpoolReplaying;
+        // Local receivers that have been added since the last spool check
+        std::set<std::string> mSpoolWakeups;
+        base::Time mLastSpoolCheck;
+        base::Time mLastSpoolStatus;
+        // Cache of the reachability of remote receivers
+        struct ReceiverReachability
+        {
+            bool reachable;
+            base::Time checked;
+        };
+        typedef std::map<std::string, ReceiverReachability> Reachability;
+        Reachability mReachability;
+
+        // Capture of ingress letters (optional)
+        LetterCapture* mLetterCapture;
+
+        // Coalescing of small letters into frames per remote MTS (optional)
+        FrameCoalescer* mFrameCoalescer;
+        // Cache of the transport addresses of the remote MTS of receivers
+        struct FramePeer
+        {
+            std::string address;
+            fipa::services::transports::Type transport_type;
+            base::Time resolved;
+            bool valid;
+        };
+        typedef std::map<std::string, FramePeer> FramePeers;
+        FramePeers mFramePeers;
+        // Letters unpacked from received frames that need to be forwarded to other MTS
+        std::vector<fipa::SerializedLetter> mUnpackedLetters;
+
+        // Multicast fan-out of letters to receivers on multiple remote MTS (optional)
+        MulticastChannel* mMulticastChannel;
+        // Receivers announced by other MTS in the multicast group
+        struct MulticastReceiver
+        {
+            std::string peer;
+            base::Time last_seen;
+        };
+        typedef std::map<std::string, MulticastReceiver> MulticastReceivers;
+        MulticastReceivers mMulticastReceivers;
+        base::Time mLastMulticastBeacon;
+
         /* Upon adding of a receiver, a new output port for this receiver is generated. Output port will be of receivers name (if successful)
          */
         virtual bool addReceiver(::std::string const & receiver, bool is_local = false);
+
+        /* Bulk version of addReceiver: the output ports for all receivers are created in a single batch,
+         * local receivers are registered one by one with the distributed service directory from updateHook
+         */
+        virtual bool addReceivers(::std::vector< ::std::string > const & receivers, bool is_local);
         
         /* Retrieve list of currently attached receivers
          */
@@ -92,19 +164,36 @@ namespace fipa_services {
          */
         virtual bool removeReceiver(::std::string const & receiver);
 
+        /* Bulk version of removeReceiver: the output ports for all receivers are removed in a single batch
+         */
+        virtual bool removeReceivers(::std::vector< ::std::string > const & receivers);
+
         /**
-        * Add an output port for a specific receiver, portname and receivername
-        * will be identical
-        * \return true on success, false otherwise
+        * Add the output ports for a set of receivers, portname and receivername
+        * will be identical. Ports of receivers that already exist will be
+        * deleted.
+        * \return names of the receivers whose ports have been added
         */
-        bool addReceiverPort(RTT::base::OutputPortInterface* outputPort, const std::string& name);
+        std::vector<std::string> addReceiverPorts(const std::vector<RTT::base::OutputPortInterface*>& outputPorts);
 
         /**
-         * Remove the output port for a specific receiver
-         * \return true on success, false otherwise
+         * Remove the output ports for a set of receivers
+         * \return names of the receivers whose ports have been removed
          */
-        bool removeReceiverPort(const std::string& name);
+        std::vector<std::string> removeReceiverPorts(const std::vector<std::string>& receivers);
         
+        /**
+         * Queue the registration or deregistration of a receiver with the
+         * distributed service directory; pending updates of the opposite kind
+         * for the same receiver cancel each other
+         */
+        void queueDirectoryUpdate(const std::string& receiver, bool registration);
+
+        /**
+         * Apply up to the given number of pending directory updates
+         */
+        void applyDirectoryUpdates(size_t maxUpdates);
+
         /**
          * Register a service (a receiver) with the distributed service directory.
          */
@@ -134,11 +223,113 @@ namespace fipa_services {
          */
         bool deliverLetterLocally(const std::string& receiverName, const fipa::acl::Letter& letter);
 
+        /**
+         * Unpack a frame and deliver its letters to local receivers
+         * immediately; letters for other receivers are queued in
+         * mUnpackedLetters to be routed after the message transport's trigger
+         * \return false if the frame is malformed, true otherwise
+         */
+        bool deliverFrame(const std::string& receiverName, const std::string& frame);
+
+        /**
+         * Create a copy of the letter which is only addressed to the given
+         * receivers
+         */
+        fipa::acl::Letter restrictReceivers(const fipa::acl::Letter& letter, const fipa::acl::AgentIDList& receivers) const;
+
+        /**
+         * Check whether a receiver is either local or known to the service
+         * directory; the service directory is queried at most once per second
+         * per receiver
+         */
+        bool isReachable(const std::string& receiver);
+
+        /**
+         * Spool the letter for all intended receivers that are currently
+         * unreachable or still have spooled letters, and hand it to the
+         * message transport for all others
+         */
+        void handleWithSpool(const fipa::SerializedLetter& serializedLetter, const fipa::acl::Letter& letter, const fipa::acl::AgentIDList& receivers);
+
+        /**
+         * Hand a letter to the message transport or add it to a frame if it
+         * qualifies for coalescing
+         */
+        void forwardLetter(const fipa::SerializedLetter& serializedLetter, const fipa::acl::Letter& letter, const fipa::acl::AgentIDList& receivers);
+
+        /**
+         * Send the letter once to the multicast group if its protocol tolerates
+         * loss and its receivers are attached to sufficiently many remote MTS
+         * supporting multicast; the letter is sent via unicast to all other
+         * receivers
+         * \return true if the letter has been handled, false if it does not
+         * qualify for multicast
+         */
+        bool multicastLetter(const fipa::SerializedLetter& serializedLetter, const fipa::acl::Letter& letter, const fipa::acl::AgentIDList& receivers);
+
+        /**
+         * Announce the local receivers to the multicast group and deliver
+         * letters received via multicast to local receivers
+         */
+        void handleMulticast();
+
+        /**
+         * Add the letter to the frame of the receiver's remote MTS
+         * \return true if the letter has been added, false if it does not
+         * qualify for coalescing
+         */
+        bool coalesceLetter(const fipa::SerializedLetter& serializedLetter, const fipa::acl::AgentIDList& receivers);
+
+        /**
+         * Resolve the transport address and type of the remote MTS a
+         * receiver is attached to
+         * \return false if the receiver is unknown or its MTS does not
+         * announce the support for frames, true otherwise
+         */
+        bool resolvePeer(const std::string& receiver, std::string& address, fipa::services::transports::Type& transportType);
+
+        /**
+         * Hand frames to the message transport -- each frame is addressed to
+         * one of its receivers which is still known to the service directory
+         */
+        void sendFrames(const std::vector<Frame>& frames);
+
+        /**
+         * Send the pending frames of the remote MTS the given receivers are
+         * attached to, so that a letter which is not coalesced does not
+         * overtake letters waiting in a frame
+         */
+        void flushFrames(const fipa::acl::AgentIDList& receivers);
+
+        /**
+         * Replay spooled letters for receivers that became reachable again
+         * and report the spool status
+         */
+        void replaySpool();
+
+        /**
+         * Start the replay of the backlog of a receiver which became reachable
+         * again
+         */
+        void startReplay(const std::string& destination);
+
+        /**
+         * Hand a replayed letter to the message transport; malformed letters
+         * are dropped
+         */
+        bool replayLetter(const fipa::SerializedLetter& serializedLetter);
+
         /**
          * Initialize the message transport
          */
         void initializeMessageTransport();
 
+        /**
+         * Delete the spool, capture, frame coalescer and multicast channel
+         * if they have been created
+         */
+        void releaseOptionalFeatures();
+
     public:
         /** TaskContext constructor for MessageTransportTask
          * \param name Name of the task. This name needs to be unique to make it identifiable via nameservices.
@@ -0,0 +1,251 @@
+#include "MulticastChannel.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <stdexcept>
+
+namespace fipa_services
+{
+
+static const uint32_t MULTICAST_MAGIC = 0x31434d46; // 'FMC1'
+static const size_t MULTICAST_HEADER_SIZE = 8;
+// Maximum size of a UDP payload
+static const size_t MULTICAST_MAX_DATAGRAM_SIZE = 65507;
+// Beacons are kept below a typical MTU to avoid fragmentation
+static const size_t MULTICAST_MAX_BEACON_SIZE = 1400;
+
+namespace {
+
+    void appendUInt16(std::vector<uint8_t>& buffer, uint16_t value)
+    {
+        buffer.push_back(static_cast<uint8_t>(value));
+        buffer.push_back(static_cast<uint8_t>(value >> 8));
+    }
+
+    uint16_t readUInt16(const uint8_t* data)
+    {
+        return static_cast<uint16_t>(data[0] | (data[1] << 8));
+    }
+
+} // end anonymous namespace
+
+MulticastChannel::MulticastChannel(const MulticastConfiguration& configuration, const std::string& id)
+    : mConfiguration(configuration)
+    , mId(id)
+    , mSocket(-1)
+    , mReceiveBuffer(MULTICAST_MAX_DATAGRAM_SIZE)
+{
+    if(id.size() > 0xffff)
+    {
+        throw std::runtime_error("MulticastChannel: identifier exceeds maximum length");
+    }
+
+    struct in_addr groupAddress;
+    if(inet_aton(configuration.group.c_str(), &groupAddress) == 0 || !IN_MULTICAST(ntohl(groupAddress.s_addr)))
+    {
+        throw std::runtime_error("MulticastChannel: '" + configuration.group + "' is not a valid multicast group address");
+    }
+
+    struct in_addr interfaceAddress;
+    interfaceAddress.s_addr = htonl(INADDR_ANY);
+    if(!configuration.interface_address.empty() && inet_aton(configuration.interface_address.c_str(), &interfaceAddress) == 0)
+    {
+        throw std::runtime_error("MulticastChannel: '" + configuration.interface_address + "' is not a valid interface address");
+    }
+
+    mSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if(mSocket < 0)
+    {
+        throw std::runtime_error(std::string("MulticastChannel: could not create socket: ") + strerror(errno));
+    }
+
+    // Allow multiple message transports on the same host to join the group
+    int reuse = 1;
+    setsockopt(mSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#ifdef SO_REUSEPORT
+    setsockopt(mSocket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+#endif
+
+    struct sockaddr_in bindAddress;
+    memset(&bindAddress, 0, sizeof(bindAddress));
+    bindAddress.sin_family = AF_INET;
+    bindAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+    bindAddress.sin_port = htons(configuration.port);
+
+    struct ip_mreq membership;
+    membership.imr_multiaddr = groupAddress;
+    membership.imr_interface = interfaceAddress;
+
+    unsigned char ttl = configuration.ttl;
+    unsigned char loop = 1;
+
+    if(bind(mSocket, reinterpret_cast<struct sockaddr*>(&bindAddress), sizeof(bindAddress)) != 0
+            || setsockopt(mSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0
+            || setsockopt(mSocket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0
+            || setsockopt(mSocket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) != 0
+            || setsockopt(mSocket, IPPROTO_IP, IP_MULTICAST_IF, &interfaceAddress, sizeof(interfaceAddress)) != 0
+            || fcntl(mSocket, F_SETFL, fcntl(mSocket, F_GETFL) | O_NONBLOCK) != 0)
+    {
+        std::string error = strerror(errno);
+        close(mSocket);
+        throw std::runtime_error("MulticastChannel: could not join multicast group '" + configuration.group + "': " + error);
+    }
+}
+
+MulticastChannel::~MulticastChannel()
+{
+    if(mSocket >= 0)
+    {
+        close(mSocket);
+    }
+}
+
+void MulticastChannel::appendHeader(std::vector<uint8_t>& buffer, DatagramType type, uint8_t representation) const
+{
+    for(size_t i = 0; i < 4; ++i)
+    {
+        buffer.push_back(static_cast<uint8_t>(MULTICAST_MAGIC >> (8*i)));
+    }
+    buffer.push_back(static_cast<uint8_t>(type));
+    buffer.push_back(representation);
+    appendUInt16(buffer, mId.size());
+    buffer.insert(buffer.end(), mId.begin(), mId.end());
+}
+
+bool MulticastChannel::send(const std::vector<uint8_t>& buffer)
+{
+    struct sockaddr_in groupAddress;
+    memset(&groupAddress, 0, sizeof(groupAddress));
+    groupAddress.sin_family = AF_INET;
+    groupAddress.sin_port = htons(mConfiguration.port);
+    inet_aton(mConfiguration.group.c_str(), &groupAddress.sin_addr);
+
+    ssize_t sent = sendto(mSocket, &buffer[0], buffer.size(), 0, reinterpret_cast<struct sockaddr*>(&groupAddress), sizeof(groupAddress));
+    return sent == static_cast<ssize_t>(buffer.size());
+}
+
+bool MulticastChannel::fits(const fipa::SerializedLetter& letter) const
+{
+    size_t datagramSize = MULTICAST_HEADER_SIZE + mId.size() + letter.getVector().size();
+    return datagramSize <= mConfiguration.max_payload && datagramSize <= MULTICAST_MAX_DATAGRAM_SIZE;
+}
+
+bool MulticastChannel::sendLetter(const fipa::SerializedLetter& letter)
+{
+    if(!fits(letter))
+    {
+        return false;
+    }
+
+    const std::vector<uint8_t>& data = letter.getVector();
+
+    std::vector<uint8_t> buffer;
+    buffer.reserve(MULTICAST_HEADER_SIZE + mId.size() + data.size());
+    appendHeader(buffer, LETTER, static_cast<uint8_t>(letter.representation));
+    buffer.insert(buffer.end(), data.begin(), data.end());
+    return send(buffer);
+}
+
+bool MulticastChannel::sendBeacon(const std::vector<std::string>& receivers)
+{
+    std::vector<uint8_t> buffer;
+    appendHeader(buffer, BEACON, 0);
+    size_t headerSize = buffer.size();
+
+    bool success = true;
+    for(std::vector<std::string>::const_iterator it = receivers.begin(); it != receivers.end(); ++it)
+    {
+        if(it->size() > 0xffff)
+        {
+            continue;
+        }
+
+        if(buffer.size() > headerSize && buffer.size() + 2 + it->size() > MULTICAST_MAX_BEACON_SIZE)
+        {
+            success = send(buffer) && success;
+            buffer.resize(headerSize);
+        }
+        appendUInt16(buffer, it->size());
+        buffer.insert(buffer.end(), it->begin(), it->end());
+    }
+
+    if(buffer.size() > headerSize)
+    {
+        success = send(buffer) && success;
+    }
+    return success;
+}
+
+bool MulticastChannel::receive(Datagram& datagram)
+{
+    while(true)
+    {
+        ssize_t received = recv(mSocket, &mReceiveBuffer[0], mReceiveBuffer.size(), 0);
+        if(received < 0)
+        {
+            // EAGAIN if no datagram is pending
+            return false;
+        }
+
+        const uint8_t* data = &mReceiveBuffer[0];
+        size_t size = received;
+        if(size < MULTICAST_HEADER_SIZE)
+        {
+            continue;
+        }
+
+        uint32_t magic = data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+        uint16_t senderLength = readUInt16(data + 6);
+        if(magic != MULTICAST_MAGIC || MULTICAST_HEADER_SIZE + senderLength > size)
+        {
+            continue;
+        }
+
+        std::string sender(reinterpret_cast<const char*>(data + MULTICAST_HEADER_SIZE), senderLength);
+        if(sender == mId)
+        {
+            continue;
+        }
+
+        size_t offset = MULTICAST_HEADER_SIZE + senderLength;
+        datagram.sender = sender;
+        datagram.receivers.clear();
+        datagram.letter = fipa::SerializedLetter();
+
+        if(data[4] == LETTER)
+        {
+            datagram.type = LETTER;
+            datagram.letter.representation = static_cast<fipa::acl::representation::Type>(data[5]);
+            datagram.letter.data.assign(data + offset, data + size);
+            return true;
+        } else if(data[4] == BEACON)
+        {
+            datagram.type = BEACON;
+            bool valid = true;
+            while(offset < size)
+            {
+                if(offset + 2 > size || offset + 2 + readUInt16(data + offset) > size)
+                {
+                    valid = false;
+                    break;
+                }
+                uint16_t length = readUInt16(data + offset);
+                datagram.receivers.push_back(std::string(reinterpret_cast<const char*>(data + offset + 2), length));
+                offset += 2 + length;
+            }
+
+            if(valid)
+            {
+                return true;
+            }
+        }
+    }
+}
+
+} // namespace fipa_services
@@ -0,0 +1,96 @@
+#ifndef FIPA_SERVICES_MULTICAST_CHANNEL_HPP
+#define FIPA_SERVICES_MULTICAST_CHANNEL_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fipa_acl/message_generator/serialized_letter.h>
+#include "fipa_servicesTypes.hpp"
+
+namespace fipa_services {
+
+    /**
+     * \class MulticastChannel
+     * \brief UDP multicast channel shared by the participating message transports
+     * \details Two kinds of datagrams are exchanged via the multicast group:
+     * - beacons, which announce the local receivers of a message transport, so that
+     *   others know which receivers can be reached via multicast
+     * - letters, which are sent once to the group -- each message transport
+     *   delivers the letter to its own local receivers
+     *
+     * Datagrams start with a header (all integers in little endian byte order)
+     \verbatim
+     uint32 magic | uint8 type | uint8 representation | uint16 sender length | char[] sender
+     \endverbatim
+     * followed by (uint16 length | char[] receiver)* for a beacon and the
+     * serialized letter for a letter.
+     * Datagrams are sent without any delivery guarantee, i.e. they are neither
+     * acknowledged nor retransmitted.
+     */
+    class MulticastChannel
+    {
+    public:
+        enum DatagramType { BEACON = 1, LETTER = 2 };
+
+        struct Datagram
+        {
+            DatagramType type;
+            /// Identifier of the sending message transport
+            std::string sender;
+            /// Announced receivers (beacon only)
+            std::vector<std::string> receivers;
+            /// Letter (letter only)
+            fipa::SerializedLetter letter;
+        };
+
+        /**
+         * Join the multicast group
+         * \param configuration Multicast configuration
+         * \param id Unique identifier of this message transport
+         * \throws std::runtime_error if the socket cannot be set up
+         */
+        MulticastChannel(const MulticastConfiguration& configuration, const std::string& id);
+
+        ~MulticastChannel();
+
+        /**
+         * Check whether a letter fits into a single datagram of the maximum
+         * payload
+         */
+        bool fits(const fipa::SerializedLetter& letter) const;
+
+        /**
+         * Send a letter to the group
+         * \return false if the datagram exceeds the maximum payload or sending failed, true otherwise
+         */
+        bool sendLetter(const fipa::SerializedLetter& letter);
+
+        /**
+         * Announce the given local receivers to the group; the receivers are
+         * split into multiple beacons if required
+         * \return false if sending failed, true otherwise
+         */
+        bool sendBeacon(const std::vector<std::string>& receivers);
+
+        /**
+         * Receive a datagram without blocking; own and malformed datagrams
+         * are skipped
+         * \return false if no datagram is available, true otherwise
+         */
+        bool receive(Datagram& datagram);
+
+        const MulticastConfiguration& getConfiguration() const { return mConfiguration; }
+
+    private:
+        void appendHeader(std::vector<uint8_t>& buffer, DatagramType type, uint8_t representation) const;
+        bool send(const std::vector<uint8_t>& buffer);
+
+        MulticastConfiguration mConfiguration;
+        std::string mId;
+        int mSocket;
+        std::vector<uint8_t> mReceiveBuffer;
+    };
+
+} // namespace fipa_services
+
+#endif // FIPA_SERVICES_MULTICAST_CHANNEL_HPP
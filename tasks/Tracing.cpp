@@ -0,0 +1,21 @@
+#include "Tracing.hpp"
+
+#ifdef FIPA_SERVICES_HAVE_SDT
+
+// Semaphores of the probes (C linkage via the declaration in Tracing.hpp) -- incremented
+// by the tracer when attaching to a probe
+#define FIPA_SERVICES_DEFINE_PROBE(probe) \
+    unsigned short fipa_services_##probe##_semaphore __attribute__ ((section (".probes"))) = 0;
+
+FIPA_SERVICES_DEFINE_PROBE(update_begin)
+FIPA_SERVICES_DEFINE_PROBE(update_end)
+FIPA_SERVICES_DEFINE_PROBE(letter_read)
+FIPA_SERVICES_DEFINE_PROBE(letter_deserialized)
+FIPA_SERVICES_DEFINE_PROBE(letter_handle_begin)
+FIPA_SERVICES_DEFINE_PROBE(letter_handle_end)
+FIPA_SERVICES_DEFINE_PROBE(trigger_begin)
+FIPA_SERVICES_DEFINE_PROBE(trigger_end)
+FIPA_SERVICES_DEFINE_PROBE(local_delivery_begin)
+FIPA_SERVICES_DEFINE_PROBE(local_delivery_end)
+
+#endif // FIPA_SERVICES_HAVE_SDT
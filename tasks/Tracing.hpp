@@ -0,0 +1,79 @@
+#ifndef FIPA_SERVICES_TRACING_HPP
+#define FIPA_SERVICES_TRACING_HPP
+
+/**
+ * Static tracepoints (USDT) along the lifecycle of a letter in the MessageTransportTask
+ *
+ * The probes of the provider 'fipa_services' are compiled in if sys/sdt.h
+ * (systemtap-sdt-dev) is available. Each probe has a semaphore, which is set by
+ * the tracer when attaching -- the probe arguments are only evaluated while
+ * the probe is traced, otherwise a probe costs a single compare.
+ *
+ * Probes and arguments:
+ \verbatim
+ update_begin()
+ update_end()
+ letter_read(size)
+ letter_deserialized(conversation_id, size)
+ letter_handle_begin(conversation_id, size)
+ letter_handle_end(conversation_id, size)
+ trigger_begin()
+ trigger_end()
+ local_delivery_begin(conversation_id, receiver)
+ local_delivery_end(conversation_id, receiver, size)
+ \endverbatim
+ *
+ * Refer to scripts/tracing for recording a trace and reconstructing per letter
+ * timelines.
+ */
+
+#ifdef FIPA_SERVICES_HAVE_SDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define FIPA_SERVICES_DECLARE_PROBE(probe) \
+    extern "C" unsigned short fipa_services_##probe##_semaphore __attribute__ ((unused)) __attribute__ ((section (".probes")));
+
+FIPA_SERVICES_DECLARE_PROBE(update_begin)
+FIPA_SERVICES_DECLARE_PROBE(update_end)
+FIPA_SERVICES_DECLARE_PROBE(letter_read)
+FIPA_SERVICES_DECLARE_PROBE(letter_deserialized)
+FIPA_SERVICES_DECLARE_PROBE(letter_handle_begin)
+FIPA_SERVICES_DECLARE_PROBE(letter_handle_end)
+FIPA_SERVICES_DECLARE_PROBE(trigger_begin)
+FIPA_SERVICES_DECLARE_PROBE(trigger_end)
+FIPA_SERVICES_DECLARE_PROBE(local_delivery_begin)
+FIPA_SERVICES_DECLARE_PROBE(local_delivery_end)
+
+/// True if the given probe is currently traced
+#define FIPA_SERVICES_TRACE_ENABLED(probe) __builtin_expect(fipa_services_##probe##_semaphore, 0)
+
+#define FIPA_SERVICES_TRACE0(probe) \
+    do { if(FIPA_SERVICES_TRACE_ENABLED(probe)) { STAP_PROBE(fipa_services, probe); } } while(0)
+#define FIPA_SERVICES_TRACE1(probe, arg1) \
+    do { if(FIPA_SERVICES_TRACE_ENABLED(probe)) { STAP_PROBE1(fipa_services, probe, arg1); } } while(0)
+
+/// Trace a letter with its conversation id and the given arguments, which are only evaluated if the probe is traced
+#define FIPA_SERVICES_TRACE_LETTER1(probe, letter, arg1) \
+    do { if(FIPA_SERVICES_TRACE_ENABLED(probe)) { \
+        std::string fipaServicesTraceConversationId = (letter).getACLMessage().getConversationID(); \
+        STAP_PROBE2(fipa_services, probe, fipaServicesTraceConversationId.c_str(), arg1); \
+    } } while(0)
+#define FIPA_SERVICES_TRACE_LETTER2(probe, letter, arg1, arg2) \
+    do { if(FIPA_SERVICES_TRACE_ENABLED(probe)) { \
+        std::string fipaServicesTraceConversationId = (letter).getACLMessage().getConversationID(); \
+        STAP_PROBE3(fipa_services, probe, fipaServicesTraceConversationId.c_str(), arg1, arg2); \
+    } } while(0)
+
+#else
+
+#define FIPA_SERVICES_TRACE_ENABLED(probe) false
+#define FIPA_SERVICES_TRACE0(probe) do {} while(0)
+#define FIPA_SERVICES_TRACE1(probe, arg1) do {} while(0)
+#define FIPA_SERVICES_TRACE_LETTER1(probe, letter, arg1) do {} while(0)
+#define FIPA_SERVICES_TRACE_LETTER2(probe, letter, arg1, arg2) do {} while(0)
+
+#endif // FIPA_SERVICES_HAVE_SDT
+
+#endif // FIPA_SERVICES_TRACING_HPP